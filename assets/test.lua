@@ -6,16 +6,25 @@ function preframe() -- Called at start of every frame
 	Setting("yoff", y + delta)
 end
 
-function callback(v, x, y, w, h) -- Called pre-render (when settings have updated) Return the new height value (v is the original height)
-	return v - math.sqrt((w / 2 - x) ^ 2 + (h / 2 - y) ^ 2) -- Apply circular gradient
+function frame(heightmap) -- Called pre-render (when settings have updated) with the whole heightmap (heights are 0-255 floats)
+	-- Bulk operations run in C: get/set(x, y), add(v), mul(v), clamp(lo, hi), radial([strength, [cx, cy]])
+	-- and map(fn), which calls fn(row, y) once per row with a table of heights (1-indexed)
+	-- frame() runs in parallel on bands of rows, one Lua state per thread, so it must only touch
+	-- rows inside heightmap:rows() and must not change settings. Coordinates are still map-wide
+	heightmap:radial() -- Apply circular gradient
 end
 
+-- Older scripts can still define a per-pixel callback instead of frame(), it is much slower
+-- function callback(v, x, y, w, h) -- Return the new height value (v is the original height)
+-- 	return v - math.sqrt((w / 2 - x) ^ 2 + (h / 2 - y) ^ 2)
+-- end
+
 function postframe(bitmap) -- Called pre-render and after biome colouring (when settings have updated)
 	local w = bitmap:width()
 	local h = bitmap:height()
 	-- NOTE: Despire Lua's array's starting from 1, C's don't so start from 0
-	for x=0, w do
-		for y=0, h do
+	for y=0, h - 1 do
+		for x=0, w - 1 do
 			local c = bitmap:pget(x, y) -- Original RGB value (ABGR formatted 32bit integer)
 			local v = bitmap:get(x, y) -- Height value (0-255, 8bit unsigned char)
 			
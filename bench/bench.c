@@ -0,0 +1,313 @@
+//
+//  bench.c
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+//  Micro and macro benchmarks for the generation pipeline. Results are
+//  written to stdout as JSON, progress goes to stderr:
+//      ./build/bench_osx > bench.json
+//      ./build/bench_osx quick=true > bench.json  (skips the largest sizes)
+//
+
+#include "perlin.h"
+#include "jobs.h"
+#include "bitmap.h"
+#include "biomes.h"
+#include "lua.h"
+#define SOKOL_IMPL
+#define SOKOL_DUMMY_BACKEND
+#include "sokol_gfx.h"
+#include "sokol_args.h"
+#define THREADS_IMPL
+#include "threads.h"
+#define JIM_IMPLEMENTATION
+#include "jim.h"
+#define MJSON_IMPLEMENTATION
+#include "mjson.h"
+
+// lua.c expects the app to provide these
+int LuaSettings(lua_State *L) {
+    lua_pushnumber(L, 0);
+    return 1;
+}
+
+int LuaDelta(lua_State *L) {
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+typedef void(*BenchFunc)(void *userdata);
+
+typedef struct {
+    double min, median, p99;
+    int runs;
+} BenchStats;
+
+#define BENCH_MIN_RUNS 3
+#define BENCH_MAX_RUNS 100
+#define BENCH_TIME_BUDGET 1.0
+
+/* Run `func` until the time budget is spent (within the run limits) and
+ * report each run's time divided by `ops`, scaled by `unit` seconds */
+static BenchStats Bench(BenchFunc func, void *userdata, double ops, double unit) {
+    double times[BENCH_MAX_RUNS];
+    int runs = 0;
+    double start = Timestamp();
+    func(userdata); // Warm up
+    while (runs < BENCH_MIN_RUNS || (runs < BENCH_MAX_RUNS && Timestamp() - start < BENCH_TIME_BUDGET)) {
+        double t = Timestamp();
+        func(userdata);
+        times[runs++] = (Timestamp() - t) / ops / unit;
+    }
+    qsort(times, runs, sizeof(double), CompareDoubles);
+    return (BenchStats) {
+        .min = times[0],
+        .median = times[runs / 2],
+        .p99 = times[MIN((int)(runs * .99), runs - 1)],
+        .runs = runs
+    };
+}
+
+static Jim jim;
+
+static void Report(const char *group, const char *name, int size, int octaves, const char *unit, BenchStats stats) {
+    fprintf(stderr, "%-10s %-22s %5d %3d  median %10.3f %s\n", group, name, size, octaves, stats.median, unit);
+    jim_object_begin(&jim);
+    jim_member_key(&jim, "group");
+    jim_string(&jim, group);
+    jim_member_key(&jim, "name");
+    jim_string(&jim, name);
+    jim_member_key(&jim, "size");
+    jim_integer(&jim, size);
+    jim_member_key(&jim, "octaves");
+    jim_integer(&jim, octaves);
+    jim_member_key(&jim, "unit");
+    jim_string(&jim, unit);
+    jim_member_key(&jim, "min");
+    jim_float(&jim, stats.min, 4);
+    jim_member_key(&jim, "median");
+    jim_float(&jim, stats.median, 4);
+    jim_member_key(&jim, "p99");
+    jim_float(&jim, stats.p99, 4);
+    jim_member_key(&jim, "runs");
+    jim_integer(&jim, stats.runs);
+    jim_object_end(&jim);
+}
+
+#define MS 1e-3
+#define NS 1e-9
+
+/* ---------------------------------------------------------------------- */
+
+#define SAMPLE_COUNT (1 << 20)
+
+typedef struct {
+    float *x, *y, *out;
+} Samples;
+
+static void PerlinScalarBench(void *userdata) {
+    Samples *s = userdata;
+    for (int i = 0; i < SAMPLE_COUNT; i++)
+        s->out[i] = Perlin(s->x[i], s->y[i], .5f);
+}
+
+static void PerlinBatchBench(void *userdata) {
+    Samples *s = userdata;
+    PerlinN(NULL, s->x, s->y, .5f, s->out, SAMPLE_COUNT);
+}
+
+static void PerlinDerivBench(void *userdata) {
+    Samples *s = userdata;
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        float d[3];
+        s->out[i] = PerlinDeriv(NULL, s->x[i], s->y[i], .5f, d) + d[0] + d[1];
+    }
+}
+
+// What a normal costs without analytic derivatives: two extra taps
+static void PerlinFiniteDiffBench(void *userdata) {
+    Samples *s = userdata;
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        float v = Perlin(s->x[i], s->y[i], .5f);
+        float dx = Perlin(s->x[i] + 1e-3f, s->y[i], .5f) - v;
+        float dy = Perlin(s->x[i], s->y[i] + 1e-3f, .5f) - v;
+        s->out[i] = v + dx + dy;
+    }
+}
+
+static void MicroBenchmarks(void) {
+    Samples s = {
+        .x = malloc(SAMPLE_COUNT * sizeof(float)),
+        .y = malloc(SAMPLE_COUNT * sizeof(float)),
+        .out = malloc(SAMPLE_COUNT * sizeof(float))
+    };
+    srand(1);
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        s.x[i] = (float)rand() / (float)RAND_MAX * 512.f - 256.f;
+        s.y[i] = (float)rand() / (float)RAND_MAX * 512.f - 256.f;
+    }
+    Report("perlin", "scalar/random", 0, 1, "ns/sample", Bench(PerlinScalarBench, &s, SAMPLE_COUNT, NS));
+    Report("perlin", "batch/random", 0, 1, "ns/sample", Bench(PerlinBatchBench, &s, SAMPLE_COUNT, NS));
+    // Rows of a 1024 wide canvas at the default scale
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        s.x[i] = (float)(i % 1024) / 200.f;
+        s.y[i] = (float)(i / 1024) / 200.f;
+    }
+    Report("perlin", "scalar/coherent", 0, 1, "ns/sample", Bench(PerlinScalarBench, &s, SAMPLE_COUNT, NS));
+    Report("perlin", "batch/coherent", 0, 1, "ns/sample", Bench(PerlinBatchBench, &s, SAMPLE_COUNT, NS));
+    Report("perlin", "deriv/coherent", 0, 1, "ns/sample", Bench(PerlinDerivBench, &s, SAMPLE_COUNT, NS));
+    Report("perlin", "finite-diff/coherent", 0, 1, "ns/sample", Bench(PerlinFiniteDiffBench, &s, SAMPLE_COUNT, NS));
+    free(s.x);
+    free(s.y);
+    free(s.out);
+}
+
+/* ---------------------------------------------------------------------- */
+
+typedef struct {
+    FBM fbm;
+    FBMParams params;
+    float *heightmap;
+    Bitmap bitmap;
+    BiomeTree biomes;
+    lua_State *L;
+    const char *path;
+} Pipeline;
+
+static void FBMBench(void *userdata) {
+    Pipeline *p = userdata;
+    p->fbm.valid = false;
+    FBMGenerate(&p->fbm, &p->params, p->heightmap);
+}
+
+static void ColorBench(void *userdata) {
+    Pipeline *p = userdata;
+    ColorHeightmap(&p->biomes, true, p->heightmap, &p->bitmap);
+}
+
+static void LuaFrameBench(void *userdata) {
+    Pipeline *p = userdata;
+    LuaCallFrame(p->L, p->heightmap, p->params.w, p->params.h);
+}
+
+static void ExportBench(void *userdata) {
+    Pipeline *p = userdata;
+    ExportBitmap(&p->bitmap, p->path);
+}
+
+static void MacroBenchmarks(int maxSize) {
+    static const int octaves[] = {1, 4, 8, 16};
+    static const Vec4 colors[] = {
+        {0.f, 0.f, .5f, 1.f}, {0.f, .4f, .8f, 1.f}, {.9f, .85f, .6f, 1.f},
+        {.2f, .6f, .2f, 1.f}, {.5f, .5f, .5f, 1.f}, {1.f, 1.f, 1.f, 1.f}
+    };
+    for (int size = 128; size <= maxSize; size *= 2) {
+        Pipeline p = {
+            .fbm = NewFBM(),
+            .params = {
+                .w = size, .h = size,
+                .scale = 200.f, .lacunarity = 2.f, .gain = .5f,
+                .normalize = NORMALIZE_LOCAL
+            },
+            .heightmap = malloc(size * size * sizeof(float)),
+            .bitmap = NewBitmap(size, size),
+            .path = "build/bench.png"
+        };
+        for (int i = 0; i < sizeof(octaves) / sizeof(octaves[0]); i++) {
+            p.params.octaves = octaves[i];
+            Report("fbm", "generate", size, octaves[i], "ms", Bench(FBMBench, &p, 1, MS));
+        }
+        p.params.derivatives = true;
+        Report("fbm", "generate-deriv", size, p.params.octaves, "ms", Bench(FBMBench, &p, 1, MS));
+        p.params.derivatives = false;
+
+        for (int i = 0; i < sizeof(colors) / sizeof(colors[0]); i++)
+            AddNewBiome(&p.biomes, colors[i], (float)(i + 1) / (float)(sizeof(colors) / sizeof(colors[0])));
+        Report("pipeline", "biome-colouring", size, 0, "ms", Bench(ColorBench, &p, 1, MS));
+        if (size <= 1024 && (p.L = LoadLuaScript("test.lua", false))) {
+            Report("pipeline", "lua-frame", size, 0, "ms", Bench(LuaFrameBench, &p, 1, MS));
+            lua_close(p.L);
+        }
+        Report("pipeline", "export-png", size, 0, "ms", Bench(ExportBench, &p, 1, MS));
+        remove(p.path);
+
+        DestroyBiomes(&p.biomes);
+        DestroyBitmap(&p.bitmap);
+        DestroyFBM(&p.fbm);
+        free(p.heightmap);
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* Column-major against row-major walks over a row-major canvas */
+
+typedef struct {
+    int w, h;
+    unsigned char *heightmap;
+    int *pixels;
+} Canvas;
+
+static void ColumnsBench(void *userdata) {
+    Canvas *c = userdata;
+    for (int x = 0; x < c->w; x++)
+        for (int y = 0; y < c->h; y++) {
+            unsigned char h = c->heightmap[y * c->w + x];
+            c->pixels[y * c->w + x] = RGB(h, h, h);
+        }
+}
+
+static void RowsBench(void *userdata) {
+    Canvas *c = userdata;
+    for (int y = 0; y < c->h; y++)
+        for (int x = 0; x < c->w; x++) {
+            unsigned char h = c->heightmap[y * c->w + x];
+            c->pixels[y * c->w + x] = RGB(h, h, h);
+        }
+}
+
+static void TraversalBenchmarks(int maxSize) {
+    for (int size = 2048; size <= maxSize; size *= 2) {
+        Canvas c = {
+            .w = size,
+            .h = size,
+            .heightmap = malloc((size_t)size * size),
+            .pixels = malloc((size_t)size * size * sizeof(int))
+        };
+        for (size_t i = 0; i < (size_t)size * size; i++)
+            c.heightmap[i] = (unsigned char)(i * 2654435761u >> 24);
+        Report("traversal", "columns", size, 0, "ms", Bench(ColumnsBench, &c, 1, MS));
+        Report("traversal", "rows", size, 0, "ms", Bench(RowsBench, &c, 1, MS));
+        free(c.heightmap);
+        free(c.pixels);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    sargs_setup(&(sargs_desc){ .argc=argc, .argv=argv });
+    int maxSize = sargs_boolean("quick") ? 1024 : 4096;
+
+    jim = (Jim) {
+        .sink = stdout,
+        .write = (Jim_Write)fwrite
+    };
+    jim_object_begin(&jim);
+    jim_member_key(&jim, "cpus");
+    jim_integer(&jim, CPUCount());
+    jim_member_key(&jim, "results");
+    jim_array_begin(&jim);
+    MicroBenchmarks();
+    MacroBenchmarks(maxSize);
+    TraversalBenchmarks(MAX(maxSize, 2048));
+    jim_array_end(&jim);
+    jim_object_end(&jim);
+    printf("\n");
+    sargs_shutdown();
+    return 0;
+}
@@ -0,0 +1,30 @@
+//
+//  arena.h
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#ifndef arena_h
+#define arena_h
+#include "platform.h"
+#include <stdlib.h>
+#include <stdbool.h>
+
+// One block carved up by a bump pointer. Buffers live until the next
+// ArenaReserve/ArenaReset, so steady-state frames never touch the heap
+typedef struct {
+    unsigned char *base;
+    size_t capacity, used, peak;
+} Arena;
+
+#define ARENA_ALIGN 64
+
+Arena NewArena(size_t capacity);
+// Drops every buffer, growing the block first if capacity is larger
+void ArenaReserve(Arena *arena, size_t capacity);
+void* ArenaAlloc(Arena *arena, size_t size);
+void ArenaReset(Arena *arena);
+void DestroyArena(Arena *arena);
+
+#endif /* arena_h */
@@ -0,0 +1,54 @@
+//
+//  biomes.h
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#ifndef biomes_h
+#define biomes_h
+#include "platform.h"
+#include "bitmap.h"
+#include "maths.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define MAX_BIOMES 16
+
+typedef struct {
+    Vec4 color;
+    float max;
+    char buffer[64];
+    int bufferLength;
+    int index;
+} BiomeData;
+
+typedef struct biome {
+    BiomeData data;
+    struct biome *next;
+} Biome;
+
+typedef struct {
+    int count, tally;
+    Biome *head, *tail;
+    // Colour for every possible height, rebuilt after BiomesChanged()
+    int palette[256];
+    bool paletteValid, paletteEnabled;
+} BiomeTree;
+
+bool SortBiomes(BiomeTree *tree);
+void AddNewBiome(BiomeTree *tree, Vec4 color, float max);
+void RemoveBiome(BiomeTree *tree, Biome *biome);
+void DestroyBiomes(BiomeTree *tree);
+void BiomesChanged(BiomeTree *tree);
+int ColorToRGB(Vec4 color);
+// The palette ColorHeightmap would apply, valid until the tree next changes
+const int* BiomePalette(BiomeTree *tree, bool enabled);
+void ColorHeightmap(BiomeTree *tree, bool enabled, const float *heightmap, Bitmap *bitmap);
+#if !WEB_BUILD
+bool ExportBiomes(BiomeTree *tree, const char *path);
+// Leaves tree as it was if path can't be read or parsed
+bool LoadBiomes(BiomeTree *tree, const char *path);
+#endif
+
+#endif /* biomes_h */
@@ -9,8 +9,10 @@
 #define bitmap_h
 #include "platform.h"
 #include "sokol_gfx.h"
+#include "png.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #define RGBA(R, G, B, A) (int)(((unsigned char)(A) << 24) | ((unsigned char)(B) << 16) | ((unsigned char)(G) << 8) | (unsigned char)(R))
 #define RGB(R, G, B) RGBA((R), (G), (B), 255)
@@ -22,12 +24,53 @@ typedef struct {
     unsigned int w, h;
 } Bitmap;
 
+// Edge of a TiledTexture tile, in pixels
+#define TEXTURE_TILE 256
+#define TEXTURE_TILES(N) (((N) + TEXTURE_TILE - 1) / TEXTURE_TILE)
+
+// A w*h texture split into TEXTURE_TILE² mipmapped textures, row by row.
+// sokol only replaces whole images, so tiling is what lets a change
+// re-upload just the tiles it touched. New textures start fully dirty
+typedef struct {
+    Texture *tiles;
+    bool *dirty;
+    int *staging;
+    int w, h, columns, rows;
+} TiledTexture;
+
 Texture NewTexture(int w, int h);
+// Streamed texture with every mip level down to 1x1, minified trilinearly
+Texture NewMipTexture(int w, int h);
 void DestroyTexture(Texture texture);
+// Ints needed for the levels below the top of a w*h mip chain
+size_t MipChainSize(int w, int h);
+// Box filters w*h pixels down into chain and uploads every level
+void UpdateMipTexture(Texture texture, const int *pixels, int w, int h, int *chain);
+TiledTexture NewTiledTexture(int w, int h);
+void DestroyTiledTexture(TiledTexture *texture);
+// Flags every tile the rectangle overlaps
+void MarkTiledTexture(TiledTexture *texture, int x, int y, int w, int h);
+// Uploads tiles flagged dirty or in mask (may be NULL), returning how many
+int UpdateTiledTexture(TiledTexture *texture, Bitmap *bitmap, const bool *mask);
+// Sets mask[tile] (laid out like TiledTexture) where a and b differ
+void BitmapDiffTiles(Bitmap *a, Bitmap *b, bool *mask);
 Bitmap NewBitmap(unsigned int w, unsigned int h);
 #if !WEB_BUILD
-void ExportBitmap(Bitmap *bitmap, const char *path);
+// Gray if every pixel has R == G == B, RGBA only if some pixel isn't opaque
+PngFormat BitmapPngFormat(Bitmap *bitmap);
+// Row y converted to format's byte layout, w * 4 bytes covers any format
+void BitmapPngRow(Bitmap *bitmap, int y, PngFormat format, unsigned char *row);
+// Streams rows through the PNG encoder, PNG_AUTO picks BitmapPngFormat
+bool ExportBitmapPNG(Bitmap *bitmap, const char *path, PngFormat format, int level);
+bool ExportBitmap(Bitmap *bitmap, const char *path);
+// Path of a PNG next to path with suffix on the stem, "a.png" -> "a_normal.png"
+void BitmapLayerPath(const char *path, const char *suffix, char *out, size_t size);
 #endif
+// Colours heights through a 256 entry palette, split over the shared job pool
+void ApplyPalette(const int *palette, const float *heightmap, Bitmap *bitmap);
+// Same, all on the calling thread, for small bitmaps where waiting on the
+// pool (and whoever else is using it) costs more than the work
+void ApplyPaletteLocal(const int *palette, const float *heightmap, Bitmap *bitmap);
 void DestroyBitmap(Bitmap *bitmap);
 
 #endif /* bitmap_h */
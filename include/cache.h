@@ -0,0 +1,59 @@
+//
+//  cache.h
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#ifndef cache_h
+#define cache_h
+#include "platform.h"
+#include "filesystem.h"
+#include <stdint.h>
+#include <time.h>
+#if !WEB_BUILD
+#include "threads.h"
+#endif
+
+// Starting value for CacheHash
+#define CACHE_HASH_INIT 14695981039346656037ull
+
+typedef struct {
+    uint64_t key;
+    size_t size;
+    time_t used;
+} DiskCacheEntry;
+
+// A directory of memory-mappable blobs named by a 64 bit key, holding at
+// most budget bytes. The least recently used blobs are deleted first, going
+// by file times so the order survives restarts. Safe to share between
+// threads
+typedef struct {
+    char dir[1024];
+    size_t budget, total;
+    DiskCacheEntry *entries;
+#if !WEB_BUILD
+    mtx_t lock;
+#endif
+} DiskCache;
+
+// A hit, data points just past the file's header into the mapping
+typedef struct {
+    void *map;
+    size_t mapSize;
+    const void *data;
+    size_t size;
+} CachedBlob;
+
+// FNV-1a, chain calls to hash several fields
+uint64_t CacheHash(uint64_t hash, const void *data, size_t size);
+
+DiskCache* NewDiskCache(const char *dir, size_t budget);
+// Maps the blob stored under key, false on a miss or if it isn't size bytes
+bool DiskCacheMap(DiskCache *cache, uint64_t key, size_t size, CachedBlob *out);
+void DiskCacheUnmap(CachedBlob *blob);
+// Writes count parts back to back as one blob, evicting old ones past budget
+bool DiskCacheStore(DiskCache *cache, uint64_t key, const void **parts, const size_t *sizes, int count);
+void DestroyDiskCache(DiskCache *cache);
+
+#endif /* cache_h */
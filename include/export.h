@@ -0,0 +1,69 @@
+//
+//  export.h
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#ifndef export_h
+#define export_h
+#include "platform.h"
+#include "bitmap.h"
+#include "heightmap.h"
+#include <stdbool.h>
+#if !WEB_BUILD
+#include "threads.h"
+
+typedef enum {
+    EXPORT_QUEUED,
+    EXPORT_RUNNING,
+    EXPORT_DONE,
+    EXPORT_FAILED
+} ExportStatus;
+
+struct exportQueue;
+
+typedef struct exportJob {
+    char path[256];
+    // Runs on a worker, returning false if the file couldn't be written
+    bool (*run)(struct exportJob *job);
+    // Frees data once run has returned
+    void (*release)(void *data);
+    void *data;
+    ExportStatus status;
+    float progress;
+    double finished;
+    struct exportQueue *queue;
+    struct exportJob *next;
+} ExportJob;
+
+// Worker threads that write files from snapshots handed over by the UI, so
+// the frame never waits on the disk. Jobs stay listed, in submission order,
+// until ExportQueuePrune drops them
+typedef struct exportQueue {
+    thrd_t *threads;
+    int threadCount;
+    mtx_t lock;
+    cnd_t wake, idle;
+    bool quit;
+    int pending;
+    ExportJob *head, *tail;
+} ExportQueue;
+
+ExportQueue* NewExportQueue(int threads);
+// Takes ownership of data, even if the job fails
+void ExportQueuePush(ExportQueue *queue, const char *path, bool (*run)(ExportJob*), void *data, void (*release)(void*));
+// Copies bitmap/heights, so the caller can keep drawing into its buffers
+void ExportQueueBitmap(ExportQueue *queue, Bitmap *bitmap, const char *path, PngFormat format, int level);
+void ExportQueueHeightmap(ExportQueue *queue, const float *heights, int w, int h, HeightFormat format, const char *path);
+// For run functions to report 0-1 through
+void ExportSetProgress(ExportJob *job, float progress);
+// Copies up to max jobs into out for display, returning how many
+int ExportQueueSnapshot(ExportQueue *queue, ExportJob *out, int max);
+// Forgets jobs that finished more than age seconds ago
+void ExportQueuePrune(ExportQueue *queue, double age);
+// Waits for every queued job to finish first
+void DestroyExportQueue(ExportQueue *queue);
+#endif
+
+#endif /* export_h */
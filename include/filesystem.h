@@ -32,5 +32,13 @@ const char** FindFiles(const char *ext);
 bool DoesFileExist(const char *path);
 bool DoesDirExist(const char *path);
 char* LoadFile(const char *path, size_t *out);
+bool MakeDir(const char *path);
+// Maps a whole file read-only, NULL if it can't be opened or is empty.
+// Pages are only read in as they're touched
+void* MapFile(const char *path, size_t *size);
+// Creates (or truncates) a size byte file and maps it read-write, writes go
+// back to the file as the pages are flushed, at the latest by UnmapFile
+void* MapNewFile(const char *path, size_t size);
+void UnmapFile(void *data, size_t size);
 
 #endif /* filesystem_h */
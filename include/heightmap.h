@@ -0,0 +1,71 @@
+//
+//  heightmap.h
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#ifndef heightmap_h
+#define heightmap_h
+#include "platform.h"
+#include "perlin.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Raw, headerless, row-major little-endian heights. R8 and R16 span the
+// full integer range, R32F is normalized to [0, 1]. PNG16 is the R16
+// samples as a compressed 16-bit grayscale PNG
+typedef enum {
+    HEIGHT_R8,
+    HEIGHT_R16,
+    HEIGHT_R32F,
+    HEIGHT_PNG16
+} HeightFormat;
+
+#if !WEB_BUILD
+// .raw/.r8, .r16, .r32/.f32 or .16.png, false for anything else
+bool HeightFormatFromPath(const char *path, HeightFormat *format);
+// heights are FBMGenerate's [0, 255] floats
+bool ExportHeightmap(const float *heights, int w, int h, HeightFormat format, const char *path);
+
+#define MAPPED_HEIGHTMAP_VERSION 1
+
+// Native (little-endian on every supported platform) and 64 bytes, so it
+// can be read straight out of the mapping
+typedef struct {
+    char magic[4];
+    uint32_t version, format, w, h;
+    // The noise settings the map was generated with
+    uint32_t octaves, seed, normalize;
+    float z, xoff, yoff, scale, lacunarity, gain;
+    // Of the first sample, page aligned
+    uint64_t offset;
+} MappedHeightmapHeader;
+
+// A headered R8, R16 or R32F heightmap written and read through a file
+// mapping, for maps too big to hold in memory. Samples are encoded as in
+// the raw formats, rows top to bottom, and only the pages a block touches
+// are ever read or written
+typedef struct {
+    MappedHeightmapHeader *header;
+    unsigned char *samples;
+    size_t size;
+    int sampleSize;
+} MappedHeightmap;
+
+// .hmap holds R16 samples, .8.hmap R8 and .32.hmap R32F, false for anything
+// else. format may be NULL to only check the extension
+bool MappedHeightmapFormat(const char *path, HeightFormat *format);
+// params are what the header records, w and h are the whole map's
+bool NewMappedHeightmap(const char *path, int w, int h, HeightFormat format, const FBMParams *params, MappedHeightmap *out);
+// Read only, false if the file isn't a mapped heightmap
+bool OpenMappedHeightmap(const char *path, MappedHeightmap *out);
+// Encodes a w x h block of [0, 255] heights straight into the map at x, y
+void MappedHeightmapWrite(MappedHeightmap *map, const float *heights, int x, int y, int w, int h);
+// Decodes a w x h block of every step-th sample from x, y back into
+// [0, 255] heights, the block must lie inside the map
+void MappedHeightmapRead(const MappedHeightmap *map, float *heights, int x, int y, int w, int h, int step);
+void CloseMappedHeightmap(MappedHeightmap *map);
+#endif
+
+#endif /* heightmap_h */
@@ -0,0 +1,40 @@
+//
+//  jobs.h
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#ifndef jobs_h
+#define jobs_h
+#include "platform.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#if !WEB_BUILD
+#include "threads.h"
+#endif
+
+typedef void(*JobFunc)(int index, void *userdata);
+
+typedef struct {
+#if !WEB_BUILD
+    thrd_t *threads;
+    mtx_t lock, runLock;
+    cnd_t wake, done;
+#endif
+    int threadCount;
+    JobFunc func;
+    void *userdata;
+    int count, next, remaining;
+    unsigned int generation;
+    bool quit;
+} JobPool;
+
+int CPUCount(void);
+double Timestamp(void);
+JobPool* NewJobPool(int threads);
+void JobPoolRun(JobPool *pool, JobFunc func, void *userdata, int count);
+void DestroyJobPool(JobPool *pool);
+JobPool* SharedJobPool(void);
+
+#endif /* jobs_h */
@@ -10,17 +10,43 @@
 #include "minilua.h"
 #include "bitmap.h"
 #include "filesystem.h"
+#include "cache.h"
 #include "maths.h"
+#include "jobs.h"
+
+// One lua_State per worker thread, all loaded from the same script. frame()
+// and callback() run in parallel on row bands, so they must only read and
+// write their own rows (heightmap:rows() gives the band). postframe() runs
+// once, on the first state. None of these can call Setting() or Delta().
+// preframe() runs on its own control state, so the viewer can call it from
+// the UI thread while the generator thread runs frame() and postframe()
+typedef struct {
+    lua_State **states;
+    lua_State *control;
+    int count;
+    // Threads still using the pool, for whoever owns it to count
+    int users;
+    // Of the script's source, so cached renders know which script made them
+    uint64_t hash;
+} LuaPool;
 
 void LuaDumpTable(lua_State* L, int table_idx);
 int LuaDumpStack(lua_State* L);
 void LuaFail(lua_State *L, char *msg, bool die);
 int LuaSettings(lua_State *L);
 int LuaDelta(lua_State *L);
-lua_State* LoadLuaScript(const char *filename);
+// Setting() and Delta() read and write the viewer's state, so only control
+// states (which run preframe) get them, elsewhere they raise an error
+lua_State* LoadLuaScript(const char *filename, bool control);
 
 void LuaCallPreframe(lua_State *L);
-void LuaCallFrame(lua_State *L, unsigned char *heightmap, int w, int h);
+void LuaCallFrame(lua_State *L, float *heightmap, int w, int h);
 void LuaCallPostframe(lua_State *L, Bitmap *bitmap);
 
+LuaPool* NewLuaPool(const char *filename, int count);
+void DestroyLuaPool(LuaPool *pool);
+void LuaPoolCallPreframe(LuaPool *pool);
+void LuaPoolCallFrame(LuaPool *pool, float *heightmap, int w, int h);
+void LuaPoolCallPostframe(LuaPool *pool, Bitmap *bitmap);
+
 #endif /* llua_h */
@@ -9,8 +9,94 @@
 #define perlin_h
 #include <float.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
+typedef enum {
+    NORMALIZE_LOCAL,  // Stretch the current window's min/max over 0-255
+    NORMALIZE_GLOBAL  // Map the fixed noise range, stable across pans and tiles
+} NormalizeMode;
+
+// A shuffled permutation (doubled to 512 entries) and the gradient index
+// each entry hashes to, with the % 12 already applied. Seed 0 is the
+// original table, so existing settings keep producing the same maps
+typedef struct {
+    unsigned int seed;
+    int perm[512];
+    int gradIndex[512];
+} NoiseContext;
+
+typedef struct {
+    int w, h;
+    float z, xoff, yoff, scale, lacunarity, gain;
+    int octaves;
+    NormalizeMode normalize;
+    unsigned int seed;
+    bool derivatives; // Also fill FBM.deriv
+    // Octaves whose lattice spacing (scale / frequency) is under this many
+    // pixels are skipped as too fine to see, 0 keeps them all. They still
+    // count towards normalization, so heights keep the full-detail range
+    float footprint;
+} FBMParams;
+
+typedef struct {
+    int x0, y0, x1, y1;
+} FBMRect;
+
+// Keeps the raw fbm grid between calls so integer pans only evaluate the
+// newly exposed strips. With a non-zero layerBudget (bytes) it also keeps
+// each octave's samples, so gain and octave edits skip noise evaluation.
+// Local normalization still rescans the whole grid after a pan
+typedef struct {
+    // What the grid was last generated with, offsets as actually used
+    FBMParams params;
+    NoiseContext noise;
+    float *grid;
+    size_t gridCapacity;
+    bool valid;
+    float min, max;
+    float *layers;
+    size_t layerCapacity, layerBudget;
+    // Rounds fractional pans to whole pixels so they can shift the grid too,
+    // leaving it up to half a pixel from the requested offsets
+    bool snapPans;
+    int layerCount;
+    // Per evaluated octave, octaves of them after footprint clamping
+    float *freq, *amp, tot;
+    int octaves, octaveCapacity;
+    FBMRect *tiles;
+    float *tileMin;
+    int tileCapacity;
+    // Interleaved d/dx, d/dy of the raw grid per pixel, when requested
+    float *deriv;
+    size_t derivCapacity;
+    // Polled per tile from worker threads, it must keep returning true once
+    // it has. A cancelled FBMGenerate returns false and drops the cache
+    bool (*cancel)(void *userdata);
+    void *cancelData;
+} FBM;
+
+// Extra outputs filled in the same tiled pass as the heights, each w*h
+// pixels packed like Bitmap.buf (R in the low byte). Either may be NULL
+typedef struct {
+    int *normals; // Tangent-space normal, XYZ in RGB, +Y up the image
+    int *slopes;  // R slope (0 flat, 255 vertical), G curvature (128 flat)
+} FBMMaps;
+
+NoiseContext NewNoiseContext(unsigned int seed);
+// Same as NewNoiseContext but served from a small LRU of recent seeds
+void CachedNoiseContext(unsigned int seed, NoiseContext *out);
 float Perlin(float x, float y, float z);
+float PerlinSeeded(const NoiseContext *noise, float x, float y, float z);
+// Perlin() plus its analytic gradient (d/dx, d/dy, d/dz) in d, noise may be NULL
+float PerlinDeriv(const NoiseContext *noise, float x, float y, float z, float d[3]);
+// noise may be NULL for the default (seed 0) table
+void PerlinN(const NoiseContext *noise, const float *x, const float *y, float z, float *out, int n);
+FBM NewFBM(void);
+// Writes w*h heights in [0, 255] to out, truncate them for an 8-bit view
+bool FBMGenerate(FBM *fbm, const FBMParams *params, float *out);
+// FBMGenerate plus maps, turning on params->derivatives if it's off
+bool FBMGenerateMaps(FBM *fbm, const FBMParams *params, float *out, const FBMMaps *maps);
+void DestroyFBM(FBM *fbm);
 unsigned char* PerlinFBM(int w, int h, float z, float xoff, float yoff, float scale, float lacunarity, float gain, int octaves);
 
 #endif /* perlin_h */
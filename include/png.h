@@ -0,0 +1,47 @@
+//
+//  png.h
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#ifndef png_h
+#define png_h
+#include "platform.h"
+#include <stdio.h>
+#include <stdbool.h>
+
+typedef enum {
+    PNG_AUTO,   // Let the caller pick from the pixels, never passed to NewPngWriter
+    PNG_GRAY8,
+    PNG_GRAY16, // Samples are big-endian, as PNG stores them
+    PNG_RGB8,
+    PNG_RGBA8
+} PngFormat;
+
+// 0 writes stored blocks, 1-9 trade speed for size like zlib's levels
+#define PNG_DEFAULT_LEVEL 6
+
+#if !WEB_BUILD
+struct PngDeflate;
+
+// Streams a PNG one row at a time: rows are filtered and deflated as they
+// arrive, so only a couple of rows and the 32K window are ever held
+typedef struct {
+    FILE *fp;
+    int w, h, rows, bpp, level;
+    PngFormat format;
+    unsigned char *prev, *filtered;
+    struct PngDeflate *z;
+    bool failed;
+} PngWriter;
+
+// NULL if path can't be opened
+PngWriter* NewPngWriter(const char *path, int w, int h, PngFormat format, int level);
+// row holds w pixels laid out as format describes
+void PngWriteRow(PngWriter *png, const unsigned char *row);
+// Flushes, closes and frees png, false if any write failed or rows are missing
+bool FinishPngWriter(PngWriter *png);
+#endif
+
+#endif /* png_h */
@@ -0,0 +1,99 @@
+//
+//  world.h
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#ifndef world_h
+#define world_h
+#include "platform.h"
+#include "perlin.h"
+#include "bitmap.h"
+#include "cache.h"
+#include "heightmap.h"
+#include <stdint.h>
+#include <stdbool.h>
+#if !WEB_BUILD
+#include "threads.h"
+#endif
+
+// Edge of a world tile in samples, a level l tile covers WORLD_TILE << l pixels
+#define WORLD_TILE 256
+// Heights plus the texture's pixels and mip chain
+#define WORLD_TILE_BYTES ((size_t)WORLD_TILE * WORLD_TILE * (3 * sizeof(float) + 4 * sizeof(int)) / 3)
+#define WORLD_MAX_LEVEL 6
+
+typedef enum {
+    WORLD_TILE_PENDING,
+    WORLD_TILE_GENERATING,
+    WORLD_TILE_READY
+} WorldTileStatus;
+
+typedef struct worldTile {
+    int x, y, level;
+    uint64_t key;
+    FBMParams params;
+    WorldTileStatus status;
+    // Heights either point into cached or are owned by the tile
+    float *heights;
+    CachedBlob cached;
+    Texture texture;
+    // Palette version the texture was coloured with, last frame it was seen
+    unsigned int palette, frame;
+    float priority;
+    struct worldTile *chain, *prev, *next;
+} WorldTile;
+
+// An endless map cut into WORLD_TILE² tiles, keyed by position, level of
+// detail and a hash of the noise settings. Tiles are generated on demand
+// (off the UI thread on desktop) nearest the middle of the view first, and
+// the least recently seen are evicted past budget bytes, so panning back or
+// returning to earlier settings reuses what was already generated. With a
+// disk cache tiles also outlive the process and are mapped back in. Heights
+// are always globally normalized so neighbouring tiles line up.
+//
+// Zoomed out views use coarser levels: a level l tile samples every 2^l
+// pixels and skips octaves finer than a sample, so a tile costs the same
+// at any zoom and detail nobody can see is never evaluated
+typedef struct {
+    WorldTile **buckets;
+    WorldTile *head, *tail;
+    int count;
+    size_t budget;
+    unsigned int frame, palette;
+    int colors[256];
+    int *pixels;
+    FBM fbm;
+    DiskCache *disk;
+    // Visible tiles this frame, the ones with a texture can be drawn.
+    // Fallbacks are coarser tiles to draw underneath until they are
+    WorldTile **visible, **fallbacks, **wanted, **uploads;
+    int visibleCount, fallbackCount, wantedCount, uploadCount, capacity;
+#if !WEB_BUILD
+    // Heights are read from here instead of generated while it's open
+    MappedHeightmap source;
+    uint64_t sourceKey;
+    thrd_t thread;
+    mtx_t lock;
+    cnd_t wake, idle;
+    bool quit, busy;
+#endif
+} World;
+
+// disk may be NULL, otherwise it must outlive the world
+World* NewWorld(size_t budget, DiskCache *disk);
+// Finds or queues every level tile overlapping world pixels [x0, x1) x
+// [y0, y1) for params (w, h, xoff, yoff, normalize and footprint are
+// ignored) and colours/uploads at most uploads of them. Tiles are always at
+// zero offset, so callers shift the rect and the drawing by xoff/yoff
+// instead. Call once a frame from the graphics thread
+void UpdateWorld(World *world, const FBMParams *params, const int *palette, int level, int x0, int y0, int x1, int y1, int uploads);
+void DestroyWorld(World *world);
+#if !WEB_BUILD
+// Shows a mapped heightmap (see heightmap.h) instead of the noise, paging in
+// only the samples under visible tiles. NULL goes back to the noise
+bool SetWorldSource(World *world, const char *path);
+#endif
+
+#endif /* world_h */
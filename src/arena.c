@@ -0,0 +1,56 @@
+//
+//  arena.c
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#include "arena.h"
+#include <assert.h>
+
+#define ALIGN_UP(N) (((N) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+
+#if defined(PLATFORM_WINDOWS)
+#include <malloc.h>
+#define ArenaMalloc(SIZE) _aligned_malloc((SIZE), ARENA_ALIGN)
+#define ArenaFree(PTR) _aligned_free(PTR)
+#else
+#define ArenaMalloc(SIZE) aligned_alloc(ARENA_ALIGN, (SIZE))
+#define ArenaFree(PTR) free(PTR)
+#endif
+
+Arena NewArena(size_t capacity) {
+    Arena arena = {0};
+    ArenaReserve(&arena, capacity);
+    return arena;
+}
+
+void ArenaReserve(Arena *arena, size_t capacity) {
+    capacity = ALIGN_UP(capacity);
+    if (capacity > arena->capacity) {
+        ArenaFree(arena->base);
+        arena->base = ArenaMalloc(capacity);
+        assert(arena->base);
+        arena->capacity = capacity;
+    }
+    arena->used = 0;
+}
+
+void* ArenaAlloc(Arena *arena, size_t size) {
+    size = ALIGN_UP(size);
+    assert(arena->used + size <= arena->capacity);
+    void *result = arena->base + arena->used;
+    arena->used += size;
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+    return result;
+}
+
+void ArenaReset(Arena *arena) {
+    arena->used = 0;
+}
+
+void DestroyArena(Arena *arena) {
+    ArenaFree(arena->base);
+    *arena = (Arena){0};
+}
@@ -0,0 +1,211 @@
+//
+//  biomes.c
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#include "biomes.h"
+#if !WEB_BUILD
+#include "filesystem.h"
+#include "jim.h"
+#include "mjson.h"
+#endif
+
+static void SwapBiomes(Biome *a, Biome *b) {
+    BiomeData tmp;
+    memcpy(&tmp, &a->data, sizeof(BiomeData));
+    memcpy(&a->data, &b->data, sizeof(BiomeData));
+    memcpy(&b->data, &tmp, sizeof(BiomeData));
+}
+
+bool SortBiomes(BiomeTree *tree) {
+    Biome *cursor = tree->head;
+    Biome *tmp = NULL;
+    bool sorted = false;
+    while (cursor) {
+        tmp = cursor->next;
+        while (tmp) {
+            if (cursor->data.max > tmp->data.max) {
+                SwapBiomes(cursor, tmp);
+                sorted = true;
+            }
+            tmp = tmp->next;
+        }
+        cursor = cursor->next;
+    }
+    return sorted;
+}
+
+void AddNewBiome(BiomeTree *tree, Vec4 color, float max) {
+    if (tree->count >= MAX_BIOMES)
+        return;
+    
+    Biome *result = malloc(sizeof(Biome));
+    result->data = (BiomeData) {
+        .color = color,
+        .max   = max,
+        .index = ++tree->tally,
+        .bufferLength = 0
+    };
+    memset(&result->data.buffer, 0, 64);
+    memcpy(&result->data.buffer, "0", sizeof(unsigned char));
+    result->next  = NULL;
+    
+    tree->count++;
+    if (!tree->head)
+        tree->head = tree->tail = result;
+    else
+        tree->tail = tree->tail->next = result;
+    
+    SortBiomes(tree);
+    BiomesChanged(tree);
+}
+
+void RemoveBiome(BiomeTree *tree, Biome *biome) {
+    Biome *cursor = tree->head, *prev = NULL;
+    while (cursor) {
+        if (cursor->data.index == biome->data.index) {
+            if (!prev)
+                tree->head = cursor->next;
+            else
+                prev->next = cursor->next;
+            if (tree->tail == cursor)
+                tree->tail = prev;
+            tree->count--;
+            free(cursor);
+            BiomesChanged(tree);
+            break;
+        }
+        prev = cursor;
+        cursor = cursor->next;
+    }
+}
+
+int ColorToRGB(Vec4 color) {
+    return RGBA((int)(color.x * 255.f), (int)(color.y * 255.f), (int)(color.z * 255.f), (int)(color.w * 255));
+}
+
+void DestroyBiomes(BiomeTree *tree) {
+    Biome *cursor = tree->head;
+    while (cursor) {
+        Biome *tmp = cursor->next;
+        free(cursor);
+        cursor = tmp;
+    }
+    tree->head = tree->tail = NULL;
+    tree->count = 0;
+    BiomesChanged(tree);
+}
+
+void BiomesChanged(BiomeTree *tree) {
+    tree->paletteValid = false;
+}
+
+static void BuildPalette(BiomeTree *tree, bool enabled) {
+    if (enabled)
+        SortBiomes(tree);
+    for (int h = 0; h < 256; h++) {
+        tree->palette[h] = RGB(h, h, h);
+        if (!enabled)
+            continue;
+        for (Biome *cursor = tree->head; cursor; cursor = cursor->next)
+            if (h <= (unsigned char)(cursor->data.max * 255.f)) {
+                tree->palette[h] = ColorToRGB(cursor->data.color);
+                break;
+            }
+    }
+    tree->paletteValid = true;
+    tree->paletteEnabled = enabled;
+}
+
+const int* BiomePalette(BiomeTree *tree, bool enabled) {
+    if (!tree->paletteValid || tree->paletteEnabled != enabled)
+        BuildPalette(tree, enabled);
+    return tree->palette;
+}
+
+void ColorHeightmap(BiomeTree *tree, bool enabled, const float *heightmap, Bitmap *bitmap) {
+    ApplyPalette(BiomePalette(tree, enabled), heightmap, bitmap);
+}
+
+#if !WEB_BUILD
+bool ExportBiomes(BiomeTree *tree, const char *path) {
+    FILE *fh = fopen(path, "w");
+    if (!fh)
+        return false;
+    Jim jim = {
+        .sink = fh,
+        .write = (Jim_Write)fwrite
+    };
+    jim_object_begin(&jim);
+    jim_member_key(&jim, "biomes");
+    jim_array_begin(&jim);
+    Biome *cursor = tree->head;
+    while (cursor) {
+        jim_object_begin(&jim);
+        jim_member_key(&jim, "r");
+        jim_integer(&jim, (long long)(cursor->data.color.x * 255.f));
+        jim_member_key(&jim, "g");
+        jim_integer(&jim, (long long)(cursor->data.color.y * 255.f));
+        jim_member_key(&jim, "b");
+        jim_integer(&jim, (long long)(cursor->data.color.z * 255.f));
+        jim_member_key(&jim, "a");
+        jim_integer(&jim, (long long)(cursor->data.color.w * 255.f));
+        jim_member_key(&jim, "max");
+        jim_float(&jim, (double)cursor->data.max, 2);
+        jim_object_end(&jim);
+        cursor = cursor->next;
+    }
+    jim_array_end(&jim);
+    jim_object_end(&jim);
+    return !fclose(fh) && jim.error == JIM_OK;
+}
+
+/* The tree is only replaced once the whole file has parsed */
+bool LoadBiomes(BiomeTree *tree, const char *path) {
+    int colorR[MAX_BIOMES];
+    int colorG[MAX_BIOMES];
+    int colorB[MAX_BIOMES];
+    int colorA[MAX_BIOMES];
+    double max[MAX_BIOMES];
+    const struct json_attr_t biome_attr[] = {
+        {"r", t_integer, .addr.integer=colorR},
+        {"g", t_integer, .addr.integer=colorG},
+        {"b", t_integer, .addr.integer=colorB},
+        {"a", t_integer, .addr.integer=colorA},
+        {"max", t_real, .addr.real=max},
+        {NULL}
+    };
+    int biomeCount = 0;
+    const struct json_attr_t root_attr[] = {
+        {"biomes", t_array, .addr.array.element_type=t_object,
+                            .addr.array.arr.objects.subtype=biome_attr,
+                            .addr.array.maxlen=MAX_BIOMES,
+                            .addr.array.count=&biomeCount},
+        {NULL}
+    };
+    
+    char *json = LoadFile(path, NULL);
+    if (!json) {
+        fprintf(stderr, "ERROR: Failed to load biomes '%s'\n", path);
+        return false;
+    }
+    int status = json_read_object(json, root_attr, NULL);
+    free(json);
+    if (status) {
+        fprintf(stderr, "ERROR: Failed to parse biomes '%s': %s\n", path, json_error_string(status));
+        return false;
+    }
+    if (!biomeCount) {
+        fprintf(stderr, "ERROR: '%s' has no biomes\n", path);
+        return false;
+    }
+    
+    if (tree->head)
+        DestroyBiomes(tree);
+    for (int i = 0; i < biomeCount; i++)
+        AddNewBiome(tree, (Vec4){(float)colorR[i] / 255.f, (float)colorG[i] / 255.f, (float)colorB[i] / 255.f, (float)colorA[i] / 255.f}, max[i]);
+    return true;
+}
+#endif
@@ -6,6 +6,9 @@
 //
 
 #include "bitmap.h"
+#include "jobs.h"
+#include "maths.h"
+#include <string.h>
 
 Texture NewTexture(int w, int h) {
     return sg_make_image(&(sg_image_desc) {
@@ -15,11 +18,164 @@ Texture NewTexture(int w, int h) {
     });
 }
 
+Texture NewMipTexture(int w, int h) {
+    int levels = 1;
+    for (int x = w, y = h; x > 1 || y > 1; x = MAX(x >> 1, 1), y = MAX(y >> 1, 1))
+        levels++;
+    return sg_make_image(&(sg_image_desc) {
+        .width = w,
+        .height = h,
+        .num_mipmaps = levels,
+        .usage = SG_USAGE_STREAM,
+        .min_filter = SG_FILTER_LINEAR_MIPMAP_LINEAR,
+        .mag_filter = SG_FILTER_NEAREST,
+        /* Tiles are drawn side by side, so filtering mustn't wrap around */
+        .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
+        .wrap_v = SG_WRAP_CLAMP_TO_EDGE
+    });
+}
+
 void DestroyTexture(Texture texture) {
     if (sg_query_image_state(texture) == SG_RESOURCESTATE_VALID)
         sg_destroy_image(texture);
 }
 
+size_t MipChainSize(int w, int h) {
+    size_t size = 0;
+    while (w > 1 || h > 1) {
+        w = MAX(w >> 1, 1);
+        h = MAX(h >> 1, 1);
+        size += (size_t)w * h;
+    }
+    return size;
+}
+
+/* Averages each 2x2 block per channel, repeating the last row or column
+ * when a side is odd */
+static void MipDownsample(const int *src, int sw, int sh, int *dst, int dw, int dh) {
+    for (int y = 0; y < dh; y++) {
+        const unsigned char *r0 = (const unsigned char*)(src + 2 * y * sw);
+        const unsigned char *r1 = (const unsigned char*)(src + MIN(2 * y + 1, sh - 1) * sw);
+        unsigned char *out = (unsigned char*)(dst + y * dw);
+        for (int x = 0; x < dw; x++) {
+            int a = 8 * x, b = 4 * MIN(2 * x + 1, sw - 1);
+            for (int c = 0; c < 4; c++)
+                out[4 * x + c] = (unsigned char)((r0[a + c] + r0[b + c] + r1[a + c] + r1[b + c] + 2) >> 2);
+        }
+    }
+}
+
+void UpdateMipTexture(Texture texture, const int *pixels, int w, int h, int *chain) {
+    sg_image_data data = {0};
+    data.subimage[0][0] = (sg_range) {
+        .ptr = pixels,
+        .size = (size_t)w * h * sizeof(int)
+    };
+    for (int level = 1; w > 1 || h > 1; level++) {
+        int dw = MAX(w >> 1, 1), dh = MAX(h >> 1, 1);
+        MipDownsample(pixels, w, h, chain, dw, dh);
+        data.subimage[0][level] = (sg_range) {
+            .ptr = chain,
+            .size = (size_t)dw * dh * sizeof(int)
+        };
+        pixels = chain;
+        chain += (size_t)dw * dh;
+        w = dw;
+        h = dh;
+    }
+    sg_update_image(texture, &data);
+}
+
+TiledTexture NewTiledTexture(int w, int h) {
+    TiledTexture texture = {
+        .w = w,
+        .h = h,
+        .columns = TEXTURE_TILES(w),
+        .rows = TEXTURE_TILES(h)
+    };
+    int count = texture.columns * texture.rows;
+    texture.tiles = malloc(count * sizeof(Texture));
+    texture.dirty = malloc(count * sizeof(bool));
+    texture.staging = malloc((TEXTURE_TILE * TEXTURE_TILE + MipChainSize(TEXTURE_TILE, TEXTURE_TILE)) * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        int x = (i % texture.columns) * TEXTURE_TILE, y = (i / texture.columns) * TEXTURE_TILE;
+        texture.tiles[i] = NewMipTexture(MIN(TEXTURE_TILE, w - x), MIN(TEXTURE_TILE, h - y));
+        texture.dirty[i] = true;
+    }
+    return texture;
+}
+
+void DestroyTiledTexture(TiledTexture *texture) {
+    for (int i = 0; i < texture->columns * texture->rows; i++)
+        DestroyTexture(texture->tiles[i]);
+    free(texture->tiles);
+    free(texture->dirty);
+    free(texture->staging);
+    *texture = (TiledTexture) {0};
+}
+
+void MarkTiledTexture(TiledTexture *texture, int x, int y, int w, int h) {
+    int x0 = MAX(x, 0) / TEXTURE_TILE, x1 = MIN(x + w, texture->w) - 1;
+    int y0 = MAX(y, 0) / TEXTURE_TILE, y1 = MIN(y + h, texture->h) - 1;
+    if (x1 < 0 || y1 < 0)
+        return;
+    for (int ty = y0; ty <= y1 / TEXTURE_TILE; ty++)
+        for (int tx = x0; tx <= x1 / TEXTURE_TILE; tx++)
+            texture->dirty[ty * texture->columns + tx] = true;
+}
+
+int UpdateTiledTexture(TiledTexture *texture, Bitmap *bitmap, const bool *mask) {
+    int uploaded = 0;
+    for (int i = 0; i < texture->columns * texture->rows; i++) {
+        if (!texture->dirty[i] && !(mask && mask[i]))
+            continue;
+        int x = (i % texture->columns) * TEXTURE_TILE, y = (i / texture->columns) * TEXTURE_TILE;
+        int w = MIN(TEXTURE_TILE, texture->w - x), h = MIN(TEXTURE_TILE, texture->h - y);
+        /* Tiles narrower than the bitmap are packed into staging first */
+        const int *src = bitmap->buf + (size_t)y * bitmap->w + x;
+        if (w != (int)bitmap->w) {
+            for (int row = 0; row < h; row++)
+                memcpy(texture->staging + row * w, src + (size_t)row * bitmap->w, w * sizeof(int));
+            src = texture->staging;
+        }
+        UpdateMipTexture(texture->tiles[i], src, w, h, texture->staging + TEXTURE_TILE * TEXTURE_TILE);
+        texture->dirty[i] = false;
+        uploaded++;
+    }
+    return uploaded;
+}
+
+typedef struct {
+    Bitmap *a, *b;
+    bool *mask;
+    int columns;
+} DiffJob;
+
+/* Compares one row of tiles, moving on from a tile at its first change */
+static void DiffTileRow(int index, void *userdata) {
+    DiffJob *job = userdata;
+    int w = job->a->w;
+    int y0 = index * TEXTURE_TILE, y1 = MIN(y0 + TEXTURE_TILE, (int)job->a->h);
+    for (int tx = 0; tx < job->columns; tx++) {
+        int x = tx * TEXTURE_TILE;
+        size_t span = MIN(TEXTURE_TILE, w - x) * sizeof(int);
+        bool changed = false;
+        for (int y = y0; y < y1 && !changed; y++)
+            changed = memcmp(job->a->buf + (size_t)y * w + x, job->b->buf + (size_t)y * w + x, span) != 0;
+        job->mask[index * job->columns + tx] = changed;
+    }
+}
+
+void BitmapDiffTiles(Bitmap *a, Bitmap *b, bool *mask) {
+    DiffJob job = {
+        .a = a,
+        .b = b,
+        .mask = mask,
+        .columns = TEXTURE_TILES(a->w)
+    };
+    JobPoolRun(SharedJobPool(), DiffTileRow, &job, TEXTURE_TILES(a->h));
+}
+
 Bitmap NewBitmap(unsigned int w, unsigned int h) {
     return (Bitmap) {
         .w = w,
@@ -29,26 +185,168 @@ Bitmap NewBitmap(unsigned int w, unsigned int h) {
 }
 
 #if !WEB_BUILD
-#define SVPNG_LINKAGE static
-#include "svpng.inc"
-
-void ExportBitmap(Bitmap *bitmap, const char *path) {
-    FILE *fp = fopen(path, "wb");
-    unsigned char *out = malloc(bitmap->w * bitmap->h * 3 * sizeof(unsigned char));
-    unsigned char *p = out;
-    for (int x = 0; x < bitmap->w; x++)
-        for (int y = 0; y < bitmap->h; y++) {
-            int c = bitmap->buf[y * bitmap->w + x];
-            *p++ = (unsigned char)( c        & 0xFF);
-            *p++ = (unsigned char)((c >> 8)  & 0xFF);
-            *p++ = (unsigned char)((c >> 16) & 0xFF);
+PngFormat BitmapPngFormat(Bitmap *bitmap) {
+    bool gray = true;
+    for (size_t i = 0, n = (size_t)bitmap->w * bitmap->h; i < n; i++) {
+        unsigned c = (unsigned)bitmap->buf[i];
+        if (c >> 24 != 0xFF)
+            return PNG_RGBA8;
+        gray &= (c & 0xFF) == ((c >> 8) & 0xFF) && (c & 0xFF) == ((c >> 16) & 0xFF);
+    }
+    return gray ? PNG_GRAY8 : PNG_RGB8;
+}
+
+void BitmapPngRow(Bitmap *bitmap, int y, PngFormat format, unsigned char *row) {
+    const int *src = bitmap->buf + (size_t)y * bitmap->w;
+    for (int x = 0; x < bitmap->w; x++) {
+        int c = src[x];
+        switch (format) {
+            case PNG_GRAY8:
+                *row++ = c & 0xFF;
+                break;
+            case PNG_GRAY16:
+                *row++ = c & 0xFF;
+                *row++ = c & 0xFF;
+                break;
+            case PNG_RGBA8:
+                memcpy(row, &c, 4);
+                row += 4;
+                break;
+            default:
+                *row++ = (unsigned char)( c        & 0xFF);
+                *row++ = (unsigned char)((c >> 8)  & 0xFF);
+                *row++ = (unsigned char)((c >> 16) & 0xFF);
+                break;
         }
-    svpng(fp, bitmap->w, bitmap->h, out, 0);
-    free(out);
-    fclose(fp);
+    }
+}
+
+bool ExportBitmapPNG(Bitmap *bitmap, const char *path, PngFormat format, int level) {
+    if (format == PNG_AUTO)
+        format = BitmapPngFormat(bitmap);
+    PngWriter *png = NewPngWriter(path, bitmap->w, bitmap->h, format, level);
+    if (!png)
+        return false;
+    // Convert a row at a time, the encoder never sees the whole image
+    unsigned char *row = malloc(bitmap->w * 4);
+    for (int y = 0; y < bitmap->h; y++) {
+        BitmapPngRow(bitmap, y, format, row);
+        PngWriteRow(png, row);
+    }
+    free(row);
+    return FinishPngWriter(png);
 }
+
+bool ExportBitmap(Bitmap *bitmap, const char *path) {
+    return ExportBitmapPNG(bitmap, path, PNG_AUTO, PNG_DEFAULT_LEVEL);
+}
+
+void BitmapLayerPath(const char *path, const char *suffix, char *out, size_t size) {
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    int stem = (int)(dot && (!slash || dot > slash) ? dot - path : strlen(path));
+    snprintf(out, size, "%.*s_%s.png", stem, path, suffix);
+}
+#else
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define PALETTE_AVX2 1
+#endif
+#endif
+
+typedef void(*PaletteFunc)(const int*, const float*, int*, int);
+
+#define PALETTE_INDEX(H) CLAMP((int)(H), 0, 255)
+
+static void ApplyPaletteScalar(const int *palette, const float *src, int *dst, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        dst[i]     = palette[PALETTE_INDEX(src[i])];
+        dst[i + 1] = palette[PALETTE_INDEX(src[i + 1])];
+        dst[i + 2] = palette[PALETTE_INDEX(src[i + 2])];
+        dst[i + 3] = palette[PALETTE_INDEX(src[i + 3])];
+    }
+    for (; i < n; i++)
+        dst[i] = palette[PALETTE_INDEX(src[i])];
+}
+
+#if defined(PALETTE_AVX2)
+/* Truncate 8 heights to indices and gather their colours at once */
+__attribute__((target("avx2")))
+static void ApplyPaletteAVX2(const int *palette, const float *src, int *dst, int n) {
+    const __m256i lo = _mm256_setzero_si256(), hi = _mm256_set1_epi32(255);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i idx = _mm256_cvttps_epi32(_mm256_loadu_ps(src + i));
+        idx = _mm256_min_epi32(_mm256_max_epi32(idx, lo), hi);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32(palette, idx, 4));
+    }
+    ApplyPaletteScalar(palette, src + i, dst + i, n - i);
+}
+#endif
+
+static PaletteFunc PaletteSelect(void) {
+#if defined(PALETTE_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return ApplyPaletteAVX2;
+#endif
+    return ApplyPaletteScalar;
+}
+
+static PaletteFunc paletteImpl = NULL;
+#if !WEB_BUILD
+static once_flag paletteOnce = ONCE_FLAG_INIT;
+#endif
+
+static void SelectPalette(void) {
+    paletteImpl = PaletteSelect();
+}
+
+/* Headless workers, the generator and the UI can all colour at once */
+static PaletteFunc PaletteImpl(void) {
+#if !WEB_BUILD
+    call_once(&paletteOnce, SelectPalette);
 #else
+    if (!paletteImpl)
+        SelectPalette();
 #endif
+    return paletteImpl;
+}
+
+#define PALETTE_BAND_ROWS 64
+
+typedef struct {
+    PaletteFunc func;
+    const int *palette;
+    const float *heightmap;
+    Bitmap *bitmap;
+} PaletteJob;
+
+static void PaletteBand(int index, void *userdata) {
+    PaletteJob *job = userdata;
+    int y0 = index * PALETTE_BAND_ROWS;
+    int rows = MIN(PALETTE_BAND_ROWS, (int)job->bitmap->h - y0);
+    size_t offset = (size_t)y0 * job->bitmap->w;
+    job->func(job->palette, job->heightmap + offset, job->bitmap->buf + offset, rows * job->bitmap->w);
+}
+
+void ApplyPalette(const int *palette, const float *heightmap, Bitmap *bitmap) {
+    PaletteJob job = {
+        .func = PaletteImpl(),
+        .palette = palette,
+        .heightmap = heightmap,
+        .bitmap = bitmap
+    };
+    JobPoolRun(SharedJobPool(), PaletteBand, &job, (bitmap->h + PALETTE_BAND_ROWS - 1) / PALETTE_BAND_ROWS);
+}
+
+void ApplyPaletteLocal(const int *palette, const float *heightmap, Bitmap *bitmap) {
+    PaletteImpl()(palette, heightmap, bitmap->buf, bitmap->w * bitmap->h);
+}
 
 void DestroyBitmap(Bitmap *bitmap) {
     if (bitmap && bitmap->buf)
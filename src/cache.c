@@ -0,0 +1,201 @@
+//
+//  cache.c
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#include "cache.h"
+#if defined(PLATFORM_WINDOWS)
+#include <sys/utime.h>
+#define utime _utime
+#define utimbuf _utimbuf
+#else
+#include <utime.h>
+#endif
+
+// Bump whenever the noise or the layout of anything stored changes, older
+// blobs are then treated as misses and age out
+#define DISK_CACHE_VERSION 1
+#define DISK_CACHE_EXT "tile"
+
+#if !WEB_BUILD
+#define CacheLock(C) mtx_lock(&(C)->lock)
+#define CacheUnlock(C) mtx_unlock(&(C)->lock)
+#else
+#define CacheLock(C)
+#define CacheUnlock(C)
+#endif
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t key, size;
+} DiskCacheHeader;
+
+uint64_t CacheHash(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+static void DiskCachePath(DiskCache *cache, uint64_t key, const char *ext, char *out) {
+    sprintf(out, "%s%s%016llx.%s", cache->dir, PATH_SEPERATOR, (unsigned long long)key, ext);
+}
+
+static int DiskCacheFind(DiskCache *cache, uint64_t key) {
+    for (int i = 0; i < VectorCount(cache->entries); i++)
+        if (cache->entries[i].key == key)
+            return i;
+    return -1;
+}
+
+/* Called with the lock held */
+static void DiskCacheRemove(DiskCache *cache, int index) {
+    char path[1100];
+    DiskCachePath(cache, cache->entries[index].key, DISK_CACHE_EXT, path);
+    remove(path);
+    cache->total -= cache->entries[index].size;
+    VectorRemove(cache->entries, index);
+}
+
+/* Called with the lock held */
+static void DiskCacheEvict(DiskCache *cache) {
+    while (cache->total > cache->budget && VectorCount(cache->entries)) {
+        int oldest = 0;
+        for (int i = 1; i < VectorCount(cache->entries); i++)
+            if (cache->entries[i].used < cache->entries[oldest].used)
+                oldest = i;
+        DiskCacheRemove(cache, oldest);
+    }
+}
+
+DiskCache* NewDiskCache(const char *dir, size_t budget) {
+    if (!MakeDir(dir))
+        return NULL;
+    DiskCache *cache = calloc(1, sizeof(DiskCache));
+    strncpy(cache->dir, dir, sizeof(cache->dir) - 1);
+    cache->budget = budget;
+#if !WEB_BUILD
+    mtx_init(&cache->lock, mtx_plain);
+#endif
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    while (d && (entry = readdir(d))) {
+        const char *ext = FileExt(entry->d_name);
+        if (!ext || strcmp(ext, DISK_CACHE_EXT))
+            continue;
+        char path[1100];
+        struct stat sb;
+        sprintf(path, "%s%s%s", dir, PATH_SEPERATOR, entry->d_name);
+        if (stat(path, &sb))
+            continue;
+        DiskCacheEntry found = {
+            .key = strtoull(entry->d_name, NULL, 16),
+            .size = sb.st_size,
+            .used = sb.st_mtime
+        };
+        VectorAppend(cache->entries, found);
+        cache->total += found.size;
+    }
+    if (d)
+        closedir(d);
+    /* The budget may have shrunk since the last run */
+    DiskCacheEvict(cache);
+    return cache;
+}
+
+bool DiskCacheMap(DiskCache *cache, uint64_t key, size_t size, CachedBlob *out) {
+    if (!cache)
+        return false;
+    char path[1100];
+    DiskCachePath(cache, key, DISK_CACHE_EXT, path);
+    CacheLock(cache);
+    int index = DiskCacheFind(cache, key);
+    CachedBlob blob = {0};
+    if (index != -1)
+        blob.map = MapFile(path, &blob.mapSize);
+    if (!blob.map) {
+        CacheUnlock(cache);
+        return false;
+    }
+    const DiskCacheHeader *header = (const DiskCacheHeader*)blob.map;
+    if (blob.mapSize != sizeof(DiskCacheHeader) + size || memcmp(header->magic, "PCHE", 4) ||
+        header->version != DISK_CACHE_VERSION || header->key != key || header->size != size) {
+        /* Stale or torn, regenerating will replace it */
+        UnmapFile(blob.map, blob.mapSize);
+        DiskCacheRemove(cache, index);
+        CacheUnlock(cache);
+        return false;
+    }
+    /* mtime doubles as the last use so the order is kept across runs */
+    struct utimbuf times;
+    times.actime = times.modtime = cache->entries[index].used = time(NULL);
+    utime(path, &times);
+    CacheUnlock(cache);
+    blob.data = (const char*)blob.map + sizeof(DiskCacheHeader);
+    blob.size = size;
+    *out = blob;
+    return true;
+}
+
+void DiskCacheUnmap(CachedBlob *blob) {
+    UnmapFile(blob->map, blob->mapSize);
+    *blob = (CachedBlob) {0};
+}
+
+/* Written to a temporary file first so a crash never leaves a torn blob
+   under the real name */
+bool DiskCacheStore(DiskCache *cache, uint64_t key, const void **parts, const size_t *sizes, int count) {
+    if (!cache)
+        return false;
+    DiskCacheHeader header = {
+        .magic = {'P', 'C', 'H', 'E'},
+        .version = DISK_CACHE_VERSION,
+        .key = key
+    };
+    for (int i = 0; i < count; i++)
+        header.size += sizes[i];
+    char tmp[1100], path[1100];
+    DiskCachePath(cache, key, "tmp", tmp);
+    DiskCachePath(cache, key, DISK_CACHE_EXT, path);
+    FILE *fh = fopen(tmp, "wb");
+    if (!fh)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, fh) == 1;
+    for (int i = 0; ok && i < count; i++)
+        ok = fwrite(parts[i], sizes[i], 1, fh) == 1;
+    ok = !fclose(fh) && ok;
+    CacheLock(cache);
+    int index = DiskCacheFind(cache, key);
+    if (index != -1)
+        DiskCacheRemove(cache, index);
+    if (ok && rename(tmp, path))
+        ok = false;
+    if (!ok) {
+        remove(tmp);
+        CacheUnlock(cache);
+        return false;
+    }
+    DiskCacheEntry entry = {
+        .key = key,
+        .size = sizeof(header) + header.size,
+        .used = time(NULL)
+    };
+    VectorAppend(cache->entries, entry);
+    cache->total += entry.size;
+    DiskCacheEvict(cache);
+    CacheUnlock(cache);
+    return true;
+}
+
+void DestroyDiskCache(DiskCache *cache) {
+    if (!cache)
+        return;
+#if !WEB_BUILD
+    mtx_destroy(&cache->lock);
+#endif
+    DestroyVector(cache->entries);
+    free(cache);
+}
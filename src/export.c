@@ -0,0 +1,194 @@
+//
+//  export.c
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#include "export.h"
+#if !WEB_BUILD
+#include "jobs.h"
+#include <string.h>
+
+/* Take the oldest queued job, finishing the backlog before quitting */
+static int ExportWorker(void *arg) {
+    ExportQueue *queue = (ExportQueue*)arg;
+    mtx_lock(&queue->lock);
+    for (;;) {
+        ExportJob *job = queue->head;
+        while (job && job->status != EXPORT_QUEUED)
+            job = job->next;
+        if (!job) {
+            if (queue->quit)
+                break;
+            cnd_wait(&queue->wake, &queue->lock);
+            continue;
+        }
+        job->status = EXPORT_RUNNING;
+        mtx_unlock(&queue->lock);
+        bool result = job->run(job);
+        if (job->release)
+            job->release(job->data);
+        mtx_lock(&queue->lock);
+        job->data = NULL;
+        job->status = result ? EXPORT_DONE : EXPORT_FAILED;
+        job->progress = 1.f;
+        job->finished = Timestamp();
+        if (!--queue->pending)
+            cnd_broadcast(&queue->idle);
+    }
+    mtx_unlock(&queue->lock);
+    return 0;
+}
+
+ExportQueue* NewExportQueue(int threads) {
+    ExportQueue *queue = calloc(1, sizeof(ExportQueue));
+    queue->threadCount = threads > 0 ? threads : 1;
+    mtx_init(&queue->lock, mtx_plain);
+    cnd_init(&queue->wake);
+    cnd_init(&queue->idle);
+    queue->threads = malloc(queue->threadCount * sizeof(thrd_t));
+    for (int i = 0; i < queue->threadCount; i++)
+        thrd_create(&queue->threads[i], ExportWorker, queue);
+    return queue;
+}
+
+void ExportQueuePush(ExportQueue *queue, const char *path, bool (*run)(ExportJob*), void *data, void (*release)(void*)) {
+    ExportJob *job = calloc(1, sizeof(ExportJob));
+    strncpy(job->path, path, sizeof(job->path) - 1);
+    job->run = run;
+    job->release = release;
+    job->data = data;
+    job->queue = queue;
+    mtx_lock(&queue->lock);
+    if (queue->tail)
+        queue->tail->next = job;
+    else
+        queue->head = job;
+    queue->tail = job;
+    queue->pending++;
+    cnd_signal(&queue->wake);
+    mtx_unlock(&queue->lock);
+}
+
+void ExportSetProgress(ExportJob *job, float progress) {
+    mtx_lock(&job->queue->lock);
+    job->progress = progress;
+    mtx_unlock(&job->queue->lock);
+}
+
+typedef struct {
+    Bitmap bitmap;
+    PngFormat format;
+    int level;
+} BitmapExport;
+
+static bool RunBitmapExport(ExportJob *job) {
+    BitmapExport *e = (BitmapExport*)job->data;
+    PngFormat format = e->format == PNG_AUTO ? BitmapPngFormat(&e->bitmap) : e->format;
+    PngWriter *png = NewPngWriter(job->path, e->bitmap.w, e->bitmap.h, format, e->level);
+    if (!png)
+        return false;
+    unsigned char *row = malloc(e->bitmap.w * 4);
+    for (int y = 0; y < e->bitmap.h; y++) {
+        BitmapPngRow(&e->bitmap, y, format, row);
+        PngWriteRow(png, row);
+        if (!(y & 63))
+            ExportSetProgress(job, (float)y / e->bitmap.h);
+    }
+    free(row);
+    return FinishPngWriter(png);
+}
+
+static void ReleaseBitmapExport(void *data) {
+    BitmapExport *e = (BitmapExport*)data;
+    DestroyBitmap(&e->bitmap);
+    free(e);
+}
+
+void ExportQueueBitmap(ExportQueue *queue, Bitmap *bitmap, const char *path, PngFormat format, int level) {
+    BitmapExport *e = malloc(sizeof(BitmapExport));
+    e->bitmap = NewBitmap(bitmap->w, bitmap->h);
+    memcpy(e->bitmap.buf, bitmap->buf, (size_t)bitmap->w * bitmap->h * sizeof(int));
+    e->format = format;
+    e->level = level;
+    ExportQueuePush(queue, path, RunBitmapExport, e, ReleaseBitmapExport);
+}
+
+typedef struct {
+    float *heights;
+    int w, h;
+    HeightFormat format;
+} HeightmapExport;
+
+static bool RunHeightmapExport(ExportJob *job) {
+    HeightmapExport *e = (HeightmapExport*)job->data;
+    return ExportHeightmap(e->heights, e->w, e->h, e->format, job->path);
+}
+
+static void ReleaseHeightmapExport(void *data) {
+    HeightmapExport *e = (HeightmapExport*)data;
+    free(e->heights);
+    free(e);
+}
+
+void ExportQueueHeightmap(ExportQueue *queue, const float *heights, int w, int h, HeightFormat format, const char *path) {
+    HeightmapExport *e = malloc(sizeof(HeightmapExport));
+    size_t size = (size_t)w * h * sizeof(float);
+    e->heights = malloc(size);
+    memcpy(e->heights, heights, size);
+    e->w = w;
+    e->h = h;
+    e->format = format;
+    ExportQueuePush(queue, path, RunHeightmapExport, e, ReleaseHeightmapExport);
+}
+
+int ExportQueueSnapshot(ExportQueue *queue, ExportJob *out, int max) {
+    int count = 0;
+    mtx_lock(&queue->lock);
+    for (ExportJob *job = queue->head; job && count < max; job = job->next)
+        out[count++] = *job;
+    mtx_unlock(&queue->lock);
+    return count;
+}
+
+void ExportQueuePrune(ExportQueue *queue, double age) {
+    double now = Timestamp();
+    mtx_lock(&queue->lock);
+    ExportJob **link = &queue->head, *last = NULL;
+    while (*link) {
+        ExportJob *job = *link;
+        if (job->status >= EXPORT_DONE && now - job->finished > age) {
+            *link = job->next;
+            free(job);
+        } else {
+            last = job;
+            link = &job->next;
+        }
+    }
+    queue->tail = last;
+    mtx_unlock(&queue->lock);
+}
+
+void DestroyExportQueue(ExportQueue *queue) {
+    if (!queue)
+        return;
+    mtx_lock(&queue->lock);
+    while (queue->pending)
+        cnd_wait(&queue->idle, &queue->lock);
+    queue->quit = true;
+    cnd_broadcast(&queue->wake);
+    mtx_unlock(&queue->lock);
+    for (int i = 0; i < queue->threadCount; i++)
+        thrd_join(queue->threads[i], NULL);
+    for (ExportJob *job = queue->head, *next; job; job = next) {
+        next = job->next;
+        free(job);
+    }
+    free(queue->threads);
+    cnd_destroy(&queue->wake);
+    cnd_destroy(&queue->idle);
+    mtx_destroy(&queue->lock);
+    free(queue);
+}
+#endif
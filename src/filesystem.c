@@ -6,6 +6,13 @@
 //
 
 #include "filesystem.h"
+#if defined(PLATFORM_WINDOWS)
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
 
 void *VectorGrow(void *arr, int increment, int itemsize) {
     int dbl_cur = arr ? 2 * vector__sbm(arr) : 0;
@@ -66,8 +73,10 @@ char* LoadFile(const char *path, size_t *length) {
     sz = ftell(fh);
     fseek(fh, 0, SEEK_SET);
 
-    result = malloc(sz * sizeof(char));
+    /* NUL terminated so text files can be parsed in place */
+    result = malloc((sz + 1) * sizeof(char));
     fread(result, sz, 1, fh);
+    result[sz] = '\0';
     fclose(fh);
     
 BAIL:
@@ -75,3 +84,85 @@ BAIL:
         *length = sz;
     return result;
 }
+
+bool MakeDir(const char *path) {
+    if (DoesDirExist(path))
+        return true;
+#if defined(PLATFORM_WINDOWS)
+    return !_mkdir(path);
+#else
+    return !mkdir(path, 0755);
+#endif
+}
+
+void* MapFile(const char *path, size_t *size) {
+    void *result = NULL;
+#if defined(PLATFORM_WINDOWS)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER length;
+    if (GetFileSizeEx(file, &length) && length.QuadPart) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            result = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+            *size = (size_t)length.QuadPart;
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    struct stat sb;
+    if (!fstat(fd, &sb) && sb.st_size) {
+        result = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (result == MAP_FAILED)
+            result = NULL;
+        *size = sb.st_size;
+    }
+    close(fd);
+#endif
+    return result;
+}
+
+void* MapNewFile(const char *path, size_t size) {
+    void *result = NULL;
+#if defined(PLATFORM_WINDOWS)
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER length = { .QuadPart = (LONGLONG)size };
+    if (SetFilePointerEx(file, length, NULL, FILE_BEGIN) && SetEndOfFile(file)) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, 0, NULL);
+        if (mapping) {
+            result = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return NULL;
+    /* Sparse, blocks are only allocated as pages are written */
+    if (!ftruncate(fd, size)) {
+        result = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (result == MAP_FAILED)
+            result = NULL;
+    }
+    close(fd);
+#endif
+    return result;
+}
+
+void UnmapFile(void *data, size_t size) {
+    if (!data)
+        return;
+#if defined(PLATFORM_WINDOWS)
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
@@ -0,0 +1,227 @@
+//
+//  heightmap.c
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#include "heightmap.h"
+#if !WEB_BUILD
+#include "filesystem.h"
+#include "maths.h"
+#include "png.h"
+
+bool HeightFormatFromPath(const char *path, HeightFormat *format) {
+    const char *ext = FileExt(path);
+    if (!ext)
+        return false;
+    size_t length = strlen(path);
+    if (length > 7 && !strcmp(path + length - 7, ".16.png"))
+        *format = HEIGHT_PNG16;
+    else if (!strcmp(ext, "raw") || !strcmp(ext, "r8"))
+        *format = HEIGHT_R8;
+    else if (!strcmp(ext, "r16"))
+        *format = HEIGHT_R16;
+    else if (!strcmp(ext, "r32") || !strcmp(ext, "f32"))
+        *format = HEIGHT_R32F;
+    else
+        return false;
+    return true;
+}
+
+static int HeightFormatSize(HeightFormat format) {
+    switch (format) {
+        case HEIGHT_R8:
+            return 1;
+        case HEIGHT_R16:
+        case HEIGHT_PNG16:
+            return 2;
+        case HEIGHT_R32F:
+        default:
+            return 4;
+    }
+}
+
+/* Encode one row, byte by byte so the file is little-endian everywhere
+ * (PNG16 is big-endian, as PNG requires) */
+static void EncodeHeights(const float *heights, int n, HeightFormat format, unsigned char *out) {
+    for (int i = 0; i < n; i++) {
+        float v = CLAMP(heights[i], 0.f, 255.f);
+        switch (format) {
+            case HEIGHT_R8:
+                out[i] = (unsigned char)v;
+                break;
+            case HEIGHT_R16: {
+                unsigned short s = (unsigned short)(v / 255.f * 65535.f + .5f);
+                out[2 * i]     = s & 0xFF;
+                out[2 * i + 1] = s >> 8;
+                break;
+            }
+            case HEIGHT_PNG16: {
+                unsigned short s = (unsigned short)(v / 255.f * 65535.f + .5f);
+                out[2 * i]     = s >> 8;
+                out[2 * i + 1] = s & 0xFF;
+                break;
+            }
+            case HEIGHT_R32F: {
+                union { float f; unsigned int u; } bits = { .f = v / 255.f };
+                for (int b = 0; b < 4; b++)
+                    out[4 * i + b] = (bits.u >> (8 * b)) & 0xFF;
+                break;
+            }
+        }
+    }
+}
+
+static bool ExportHeightmapPNG(const float *heights, int w, int h, const char *path) {
+    PngWriter *png = NewPngWriter(path, w, h, PNG_GRAY16, PNG_DEFAULT_LEVEL);
+    if (!png)
+        return false;
+    unsigned char *row = malloc((size_t)w * 2);
+    for (int y = 0; y < h; y++) {
+        EncodeHeights(heights + (size_t)y * w, w, HEIGHT_PNG16, row);
+        PngWriteRow(png, row);
+    }
+    free(row);
+    return FinishPngWriter(png);
+}
+
+/* The inverse of EncodeHeights, back to [0, 255] */
+static void DecodeHeights(const unsigned char *in, int n, HeightFormat format, float *heights) {
+    for (int i = 0; i < n; i++)
+        switch (format) {
+            case HEIGHT_R8:
+                heights[i] = (float)in[i];
+                break;
+            case HEIGHT_R16:
+                heights[i] = (float)(in[2 * i] | (in[2 * i + 1] << 8)) / 65535.f * 255.f;
+                break;
+            case HEIGHT_PNG16:
+                heights[i] = (float)((in[2 * i] << 8) | in[2 * i + 1]) / 65535.f * 255.f;
+                break;
+            case HEIGHT_R32F: {
+                union { float f; unsigned int u; } bits = { .u = 0 };
+                for (int b = 0; b < 4; b++)
+                    bits.u |= (unsigned int)in[4 * i + b] << (8 * b);
+                heights[i] = bits.f * 255.f;
+                break;
+            }
+        }
+}
+
+bool ExportHeightmap(const float *heights, int w, int h, HeightFormat format, const char *path) {
+    if (format == HEIGHT_PNG16)
+        return ExportHeightmapPNG(heights, w, h, path);
+    FILE *fh = fopen(path, "wb");
+    if (!fh)
+        return false;
+    // Encode a row at a time so exports never need a second full-size buffer
+    size_t stride = (size_t)w * HeightFormatSize(format);
+    unsigned char *row = malloc(stride);
+    bool result = true;
+    for (int y = 0; y < h && result; y++) {
+        EncodeHeights(heights + (size_t)y * w, w, format, row);
+        result = fwrite(row, 1, stride, fh) == stride;
+    }
+    free(row);
+    fclose(fh);
+    return result;
+}
+
+// Samples start on their own page so readers can map just those
+#define MAPPED_HEIGHTMAP_OFFSET 4096
+
+bool MappedHeightmapFormat(const char *path, HeightFormat *format) {
+    const char *ext = FileExt(path);
+    if (!ext || strcmp(ext, "hmap"))
+        return false;
+    HeightFormat result = HEIGHT_R16;
+    size_t length = strlen(path);
+    if (length > 7 && !strcmp(path + length - 7, ".8.hmap"))
+        result = HEIGHT_R8;
+    else if (length > 8 && !strcmp(path + length - 8, ".32.hmap"))
+        result = HEIGHT_R32F;
+    if (format)
+        *format = result;
+    return true;
+}
+
+bool NewMappedHeightmap(const char *path, int w, int h, HeightFormat format, const FBMParams *params, MappedHeightmap *out) {
+    if (format == HEIGHT_PNG16)
+        return false;
+    size_t size = MAPPED_HEIGHTMAP_OFFSET + (size_t)w * h * HeightFormatSize(format);
+    void *map = MapNewFile(path, size);
+    if (!map)
+        return false;
+    *out = (MappedHeightmap) {
+        .header = (MappedHeightmapHeader*)map,
+        .samples = (unsigned char*)map + MAPPED_HEIGHTMAP_OFFSET,
+        .size = size,
+        .sampleSize = HeightFormatSize(format)
+    };
+    *out->header = (MappedHeightmapHeader) {
+        .magic = {'H', 'M', 'A', 'P'},
+        .version = MAPPED_HEIGHTMAP_VERSION,
+        .format = format,
+        .w = w,
+        .h = h,
+        .octaves = params->octaves,
+        .seed = params->seed,
+        .normalize = params->normalize,
+        .z = params->z,
+        .xoff = params->xoff,
+        .yoff = params->yoff,
+        .scale = params->scale,
+        .lacunarity = params->lacunarity,
+        .gain = params->gain,
+        .offset = MAPPED_HEIGHTMAP_OFFSET
+    };
+    return true;
+}
+
+bool OpenMappedHeightmap(const char *path, MappedHeightmap *out) {
+    size_t size;
+    void *map = MapFile(path, &size);
+    if (!map)
+        return false;
+    MappedHeightmapHeader *header = (MappedHeightmapHeader*)map;
+    if (size < sizeof(MappedHeightmapHeader) || memcmp(header->magic, "HMAP", 4) ||
+        header->version != MAPPED_HEIGHTMAP_VERSION || header->format == HEIGHT_PNG16 || header->format > HEIGHT_R32F ||
+        header->offset + (uint64_t)header->w * header->h * HeightFormatSize(header->format) > size) {
+        UnmapFile(map, size);
+        return false;
+    }
+    *out = (MappedHeightmap) {
+        .header = header,
+        .samples = (unsigned char*)map + header->offset,
+        .size = size,
+        .sampleSize = HeightFormatSize(header->format)
+    };
+    return true;
+}
+
+void MappedHeightmapWrite(MappedHeightmap *map, const float *heights, int x, int y, int w, int h) {
+    size_t stride = (size_t)map->header->w * map->sampleSize;
+    for (int row = 0; row < h; row++)
+        EncodeHeights(heights + (size_t)row * w, w, map->header->format,
+                      map->samples + (size_t)(y + row) * stride + (size_t)x * map->sampleSize);
+}
+
+void MappedHeightmapRead(const MappedHeightmap *map, float *heights, int x, int y, int w, int h, int step) {
+    size_t stride = (size_t)map->header->w * map->sampleSize;
+    for (int row = 0; row < h; row++) {
+        const unsigned char *src = map->samples + (size_t)(y + row * step) * stride + (size_t)x * map->sampleSize;
+        float *dst = heights + (size_t)row * w;
+        if (step == 1)
+            DecodeHeights(src, w, map->header->format, dst);
+        else
+            for (int i = 0; i < w; i++)
+                DecodeHeights(src + (size_t)i * step * map->sampleSize, 1, map->header->format, dst + i);
+    }
+}
+
+void CloseMappedHeightmap(MappedHeightmap *map) {
+    UnmapFile(map->header, map->size);
+    *map = (MappedHeightmap) {0};
+}
+#endif
@@ -0,0 +1,155 @@
+//
+//  jobs.c
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#include "jobs.h"
+#if defined(PLATFORM_WINDOWS)
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <time.h>
+#endif
+
+int CPUCount(void) {
+#if WEB_BUILD
+    return 1;
+#elif defined(PLATFORM_WINDOWS)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+double Timestamp(void) {
+#if defined(PLATFORM_WINDOWS)
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+#if !WEB_BUILD
+/* Take indices until the current batch is exhausted. Called with the lock held */
+static void JobPoolDrain(JobPool *pool) {
+    while (pool->next < pool->count) {
+        int index = pool->next++;
+        JobFunc func = pool->func;
+        void *userdata = pool->userdata;
+        mtx_unlock(&pool->lock);
+        func(index, userdata);
+        mtx_lock(&pool->lock);
+        if (!--pool->remaining)
+            cnd_broadcast(&pool->done);
+    }
+}
+
+static int JobPoolWorker(void *arg) {
+    JobPool *pool = (JobPool*)arg;
+    unsigned int generation = 0;
+    mtx_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && generation == pool->generation)
+            cnd_wait(&pool->wake, &pool->lock);
+        if (pool->quit)
+            break;
+        generation = pool->generation;
+        JobPoolDrain(pool);
+    }
+    mtx_unlock(&pool->lock);
+    return 0;
+}
+#endif
+
+JobPool* NewJobPool(int threads) {
+    JobPool *pool = calloc(1, sizeof(JobPool));
+#if !WEB_BUILD
+    /* The thread calling JobPoolRun works too, so spawn one less */
+    if (threads <= 0)
+        threads = CPUCount();
+    pool->threadCount = threads - 1;
+    mtx_init(&pool->lock, mtx_plain);
+    mtx_init(&pool->runLock, mtx_plain);
+    cnd_init(&pool->wake);
+    cnd_init(&pool->done);
+    if (pool->threadCount > 0) {
+        pool->threads = malloc(pool->threadCount * sizeof(thrd_t));
+        for (int i = 0; i < pool->threadCount; i++)
+            thrd_create(&pool->threads[i], JobPoolWorker, pool);
+    }
+#endif
+    return pool;
+}
+
+void JobPoolRun(JobPool *pool, JobFunc func, void *userdata, int count) {
+#if !WEB_BUILD
+    if (pool && pool->threadCount > 0 && count > 1) {
+        mtx_lock(&pool->runLock);
+        mtx_lock(&pool->lock);
+        pool->func = func;
+        pool->userdata = userdata;
+        pool->count = count;
+        pool->next = 0;
+        pool->remaining = count;
+        pool->generation++;
+        cnd_broadcast(&pool->wake);
+        JobPoolDrain(pool);
+        while (pool->remaining)
+            cnd_wait(&pool->done, &pool->lock);
+        mtx_unlock(&pool->lock);
+        mtx_unlock(&pool->runLock);
+        return;
+    }
+#endif
+    for (int i = 0; i < count; i++)
+        func(i, userdata);
+}
+
+void DestroyJobPool(JobPool *pool) {
+    if (!pool)
+        return;
+#if !WEB_BUILD
+    mtx_lock(&pool->lock);
+    pool->quit = true;
+    cnd_broadcast(&pool->wake);
+    mtx_unlock(&pool->lock);
+    for (int i = 0; i < pool->threadCount; i++)
+        thrd_join(pool->threads[i], NULL);
+    free(pool->threads);
+    cnd_destroy(&pool->wake);
+    cnd_destroy(&pool->done);
+    mtx_destroy(&pool->lock);
+    mtx_destroy(&pool->runLock);
+#endif
+    free(pool);
+}
+
+static JobPool *sharedPool = NULL;
+
+#if !WEB_BUILD
+static once_flag sharedPoolOnce = ONCE_FLAG_INIT;
+
+static void CreateSharedJobPool(void) {
+    sharedPool = NewJobPool(0);
+}
+#endif
+
+JobPool* SharedJobPool(void) {
+#if !WEB_BUILD
+    call_once(&sharedPoolOnce, CreateSharedJobPool);
+#else
+    if (!sharedPool)
+        sharedPool = NewJobPool(1);
+#endif
+    return sharedPool;
+}
@@ -138,7 +138,145 @@ static const struct luaL_Reg BitmapFunctions[] = {
     {NULL, NULL}
 };
 
-lua_State* LoadLuaScript(const char *filename) {
+// Scripts only see rows [y0, y1), when a frame is split across a LuaPool
+// each state gets its own band of the map
+typedef struct {
+    float *data;
+    int w, h, y0, y1;
+} LuaHeightmap;
+
+#define HEIGHT(V) (float)CLAMP((V), 0.f, 255.f)
+
+static int LuaHeightmapGet(lua_State *L) {
+    LuaHeightmap *hm = (LuaHeightmap*)luaL_checkudata(L, 1, "Heightmap");
+    unsigned int x = (unsigned int)luaL_checkinteger(L, 2);
+    unsigned int y = (unsigned int)luaL_checkinteger(L, 3);
+    luaL_argcheck(L, x < hm->w, 2, "out of bounds");
+    luaL_argcheck(L, y >= hm->y0 && y < hm->y1, 3, "out of bounds");
+    lua_pushnumber(L, hm->data[y * hm->w + x]);
+    return 1;
+}
+
+static int LuaHeightmapSet(lua_State *L) {
+    LuaHeightmap *hm = (LuaHeightmap*)luaL_checkudata(L, 1, "Heightmap");
+    unsigned int x = (unsigned int)luaL_checkinteger(L, 2);
+    unsigned int y = (unsigned int)luaL_checkinteger(L, 3);
+    luaL_argcheck(L, x < hm->w, 2, "out of bounds");
+    luaL_argcheck(L, y >= hm->y0 && y < hm->y1, 3, "out of bounds");
+    hm->data[y * hm->w + x] = HEIGHT(luaL_checknumber(L, 4));
+    return 0;
+}
+
+static int LuaHeightmapWidth(lua_State *L) {
+    LuaHeightmap *hm = (LuaHeightmap*)luaL_checkudata(L, 1, "Heightmap");
+    lua_pushinteger(L, hm->w);
+    return 1;
+}
+
+static int LuaHeightmapHeight(lua_State *L) {
+    LuaHeightmap *hm = (LuaHeightmap*)luaL_checkudata(L, 1, "Heightmap");
+    lua_pushinteger(L, hm->h);
+    return 1;
+}
+
+static int LuaHeightmapRows(lua_State *L) {
+    LuaHeightmap *hm = (LuaHeightmap*)luaL_checkudata(L, 1, "Heightmap");
+    lua_pushinteger(L, hm->y0);
+    lua_pushinteger(L, hm->y1);
+    return 2;
+}
+
+// heightmap:map(fn) calls fn(row, y) once per row, row is a table of the
+// row's heights (1-indexed). fn may edit row in place or return a new table
+static int LuaHeightmapMap(lua_State *L) {
+    LuaHeightmap *hm = (LuaHeightmap*)luaL_checkudata(L, 1, "Heightmap");
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    lua_createtable(L, hm->w, 0);
+    int row = lua_gettop(L);
+    for (int y = hm->y0; y < hm->y1; y++) {
+        float *data = hm->data + y * hm->w;
+        for (int x = 0; x < hm->w; x++) {
+            lua_pushnumber(L, data[x]);
+            lua_rawseti(L, row, x + 1);
+        }
+        lua_pushvalue(L, 2);
+        lua_pushvalue(L, row);
+        lua_pushinteger(L, y);
+        lua_call(L, 2, 1);
+        int result = lua_istable(L, -1) ? lua_gettop(L) : row;
+        for (int x = 0; x < hm->w; x++) {
+            lua_rawgeti(L, result, x + 1);
+            data[x] = HEIGHT(luaL_checknumber(L, -1));
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    return 0;
+}
+
+static int LuaHeightmapAdd(lua_State *L) {
+    LuaHeightmap *hm = (LuaHeightmap*)luaL_checkudata(L, 1, "Heightmap");
+    float v = (float)luaL_checknumber(L, 2);
+    for (int i = hm->y0 * hm->w; i < hm->y1 * hm->w; i++)
+        hm->data[i] = HEIGHT(hm->data[i] + v);
+    return 0;
+}
+
+static int LuaHeightmapMul(lua_State *L) {
+    LuaHeightmap *hm = (LuaHeightmap*)luaL_checkudata(L, 1, "Heightmap");
+    float v = (float)luaL_checknumber(L, 2);
+    for (int i = hm->y0 * hm->w; i < hm->y1 * hm->w; i++)
+        hm->data[i] = HEIGHT(hm->data[i] * v);
+    return 0;
+}
+
+static int LuaHeightmapClamp(lua_State *L) {
+    LuaHeightmap *hm = (LuaHeightmap*)luaL_checkudata(L, 1, "Heightmap");
+    float lo = (float)luaL_checknumber(L, 2);
+    float hi = (float)luaL_checknumber(L, 3);
+    for (int i = hm->y0 * hm->w; i < hm->y1 * hm->w; i++)
+        hm->data[i] = HEIGHT(CLAMP(hm->data[i], lo, hi));
+    return 0;
+}
+
+// heightmap:radial([strength, [cx, cy]]) subtracts strength * distance from
+// (cx, cy), which defaults to the centre of the map
+static int LuaHeightmapRadial(lua_State *L) {
+    LuaHeightmap *hm = (LuaHeightmap*)luaL_checkudata(L, 1, "Heightmap");
+    double strength = luaL_optnumber(L, 2, 1.);
+    double cx = luaL_optnumber(L, 3, hm->w * .5);
+    double cy = luaL_optnumber(L, 4, hm->h * .5);
+    for (int y = hm->y0; y < hm->y1; y++) {
+        double dy = cy - y;
+        for (int x = 0; x < hm->w; x++) {
+            double dx = cx - x;
+            float *v = &hm->data[y * hm->w + x];
+            *v = HEIGHT(*v - strength * sqrt(dx * dx + dy * dy));
+        }
+    }
+    return 0;
+}
+
+static const struct luaL_Reg HeightmapMethods[] = {
+    {"get", LuaHeightmapGet},
+    {"set", LuaHeightmapSet},
+    {"width", LuaHeightmapWidth},
+    {"height", LuaHeightmapHeight},
+    {"rows", LuaHeightmapRows},
+    {"map", LuaHeightmapMap},
+    {"add", LuaHeightmapAdd},
+    {"mul", LuaHeightmapMul},
+    {"clamp", LuaHeightmapClamp},
+    {"radial", LuaHeightmapRadial},
+    {NULL, NULL}
+};
+
+static int LuaControlOnly(lua_State *L) {
+    return luaL_error(L, "Setting() and Delta() can only be called from preframe()");
+}
+
+lua_State* LoadLuaScript(const char *filename, bool control) {
     lua_State *L = luaL_newstate();
     luaL_openlibs(L);
     
@@ -147,12 +285,19 @@ lua_State* LoadLuaScript(const char *filename) {
     lua_setfield(L, -2, "__index");
     luaL_setfuncs(L, BitmapMethods, 0);
     luaL_newlib(L, BitmapFunctions);
+    lua_pop(L, 2);
+    
+    luaL_newmetatable(L, "Heightmap");
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_setfuncs(L, HeightmapMethods, 0);
+    lua_pop(L, 1);
     
     lua_pushcfunction(L, LuaRGB);
     lua_setglobal(L, "RGB");
-    lua_pushcfunction(L, LuaSettings);
+    lua_pushcfunction(L, control ? LuaSettings : LuaControlOnly);
     lua_setglobal(L, "Setting");
-    lua_pushcfunction(L, LuaDelta);
+    lua_pushcfunction(L, control ? LuaDelta : LuaControlOnly);
     lua_setglobal(L, "Delta");
     lua_pushcfunction(L, LuaDumpStack);
     lua_setglobal(L, "DumpStack");
@@ -166,16 +311,39 @@ lua_State* LoadLuaScript(const char *filename) {
 
 void LuaCallPreframe(lua_State *L) {
     lua_getglobal(L, "preframe");
-    if (lua_isfunction(L, -1) && lua_pcall(L, 0, 0, 0))
+    if (!lua_isfunction(L, -1)) {
+        lua_pop(L, 1);
+        return;
+    }
+    if (lua_pcall(L, 0, 0, 0))
         LuaFail(L, "Failed to execute Lua script", false);
 }
 
-void LuaCallFrame(lua_State *L, unsigned char *heightmap, int w, int h) {
+static void LuaCallFrameRows(lua_State *L, float *heightmap, int w, int h, int y0, int y1) {
+    lua_getglobal(L, "frame");
+    if (lua_isfunction(L, -1)) {
+        LuaHeightmap *hm = (LuaHeightmap*)lua_newuserdata(L, sizeof(LuaHeightmap));
+        hm->data = heightmap;
+        hm->w = w;
+        hm->h = h;
+        hm->y0 = y0;
+        hm->y1 = y1;
+        luaL_getmetatable(L, "Heightmap");
+        lua_setmetatable(L, -2);
+        if (lua_pcall(L, 1, 0, 0))
+            LuaFail(L, "Failed to execute Lua script", false);
+        return;
+    }
+    lua_pop(L, 1);
+    
+    // Per-pixel compatibility path for scripts without frame()
     lua_getglobal(L, "callback");
-    if (!lua_isfunction(L, -1))
+    bool exists = lua_isfunction(L, -1);
+    lua_pop(L, 1);
+    if (!exists)
         return;
-    for (int x = 0; x < w; x++)
-        for (int y = 0; y < h; y++) {
+    for (int y = y0; y < y1; y++)
+        for (int x = 0; x < w; x++) {
             lua_getglobal(L, "callback");
             lua_pushnumber(L, heightmap[y * w + x]);
             lua_pushinteger(L, x);
@@ -186,15 +354,21 @@ void LuaCallFrame(lua_State *L, unsigned char *heightmap, int w, int h) {
                 LuaFail(L, "Failed to execute Lua script", false);
             if (!lua_isnumber(L, -1))
                 LuaFail(L, "Invalid return value from Lua callback", false);
-            heightmap[y * w + x] = CLAMP(lua_tonumber(L, -1), 0, 255);
+            heightmap[y * w + x] = HEIGHT(lua_tonumber(L, -1));
             lua_pop(L, 1);
         }
 }
 
+void LuaCallFrame(lua_State *L, float *heightmap, int w, int h) {
+    LuaCallFrameRows(L, heightmap, w, h, 0, h);
+}
+
 void LuaCallPostframe(lua_State *L, Bitmap *bitmap) {
     lua_getglobal(L, "postframe");
-    if (!lua_isfunction(L, -1))
+    if (!lua_isfunction(L, -1)) {
+        lua_pop(L, 1);
         return;
+    }
     LuaBitmap *lbitmap = (LuaBitmap*)lua_newuserdata(L, sizeof(LuaBitmap));
     lbitmap->bitmap = bitmap;
     luaL_getmetatable(L, "Bitmap");
@@ -202,3 +376,69 @@ void LuaCallPostframe(lua_State *L, Bitmap *bitmap) {
     if (lua_pcall(L, 1, 0, 0))
         LuaFail(L, "Failed to execute Lua script", false);
 }
+
+LuaPool* NewLuaPool(const char *filename, int count) {
+    if (count <= 0)
+        count = SharedJobPool()->threadCount + 1; // Workers plus the caller
+    LuaPool *pool = malloc(sizeof(LuaPool));
+    pool->states = malloc(count * sizeof(lua_State*));
+    pool->count = count;
+    for (int i = 0; i < count; i++)
+        pool->states[i] = LoadLuaScript(filename, false);
+    pool->control = LoadLuaScript(filename, true);
+    pool->users = 0;
+    char asset[1024];
+    size_t size;
+    sprintf(asset, "assets%s%s", PATH_SEPERATOR, filename);
+    char *source = LoadFile(asset, &size);
+    pool->hash = source ? CacheHash(CACHE_HASH_INIT, source, size) : 0;
+    free(source);
+    return pool;
+}
+
+void DestroyLuaPool(LuaPool *pool) {
+    if (!pool)
+        return;
+    for (int i = 0; i < pool->count; i++)
+        lua_close(pool->states[i]);
+    lua_close(pool->control);
+    free(pool->states);
+    free(pool);
+}
+
+void LuaPoolCallPreframe(LuaPool *pool) {
+    LuaCallPreframe(pool->control);
+}
+
+typedef struct {
+    LuaPool *pool;
+    float *heightmap;
+    int w, h, rows;
+} LuaFrameJob;
+
+static void LuaFrameBand(int index, void *userdata) {
+    LuaFrameJob *job = userdata;
+    int y0 = index * job->rows;
+    LuaCallFrameRows(job->pool->states[index], job->heightmap, job->w, job->h, y0, MIN(y0 + job->rows, job->h));
+}
+
+void LuaPoolCallFrame(LuaPool *pool, float *heightmap, int w, int h) {
+    int bands = MIN(pool->count, h);
+    if (bands <= 1) {
+        LuaCallFrame(pool->states[0], heightmap, w, h);
+        return;
+    }
+    LuaFrameJob job = {
+        .pool = pool,
+        .heightmap = heightmap,
+        .w = w,
+        .h = h,
+        .rows = (h + bands - 1) / bands
+    };
+    // Band i always runs on state i, so no state is ever used by two threads
+    JobPoolRun(SharedJobPool(), LuaFrameBand, &job, (h + job.rows - 1) / job.rows);
+}
+
+void LuaPoolCallPostframe(LuaPool *pool, Bitmap *bitmap) {
+    LuaCallPostframe(pool->states[0], bitmap);
+}
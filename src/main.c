@@ -2,6 +2,13 @@
 #include "perlin.h"
 #include "vector.h"
 #include "bitmap.h"
+#include "jobs.h"
+#include "biomes.h"
+#include "heightmap.h"
+#include "arena.h"
+#include "world.h"
+#include "cache.h"
+#include <limits.h>
 #define NK_INCLUDE_FIXED_TYPES
 #define NK_INCLUDE_STANDARD_IO
 #define NK_INCLUDE_DEFAULT_ALLOCATOR
@@ -23,6 +30,7 @@
 #if !WEB_BUILD
 #include "filesystem.h"
 #include "lua.h"
+#include "export.h"
 #define DMON_IMPL
 #include "dmon.h"
 #define THREADS_IMPL
@@ -36,6 +44,21 @@
 #endif
 
 #define DEFAULT_CANVAS_SIZE 512
+// Memory (MB) the octave layer cache may use, override with layerBudget=N
+#define DEFAULT_LAYER_BUDGET 256
+// Memory (MB) infinite world tiles may use, override with worldBudget=N
+#define DEFAULT_WORLD_BUDGET 512
+// Disk space (MB) for renders kept across runs, override with diskBudget=N
+// (0 turns it off) and the directory with cacheDir=PATH
+#define DEFAULT_DISK_BUDGET 2048
+#define DEFAULT_CACHE_DIR "cache"
+// Renders quicker than this (seconds) aren't worth the disk write
+#define DISK_CACHE_MIN_TIME .02
+// Edge of the blocks mapped heightmap exports are generated in
+#define MAPPED_EXPORT_TILE 1024
+// Manifest jobs run at once, override with manifestWorkers=N
+#define DEFAULT_MANIFEST_WORKERS 4
+#define WORLD_UPLOADS_PER_FRAME 8
 
 #define SETTINGS                              \
     X(int, canvasWidth, DEFAULT_CANVAS_SIZE)  \
@@ -46,7 +69,11 @@
     X(float, scale, 200.f)                    \
     X(float, lacunarity, 2.f)                 \
     X(float, gain, .5f)                       \
-    X(int, octaves, 8)
+    X(int, octaves, 8)                        \
+    X(int, normalize, NORMALIZE_LOCAL)        \
+    X(int, seed, 0)                           \
+    X(int, surfaceMaps, 0)                    \
+    X(int, pngLevel, PNG_DEFAULT_LEVEL)
 typedef struct {
 #define X(TYPE, NAME, DEFAULT) TYPE NAME;
     SETTINGS
@@ -59,29 +86,142 @@ static Settings settings = {
 #undef X
 };
 
+static FBMParams SettingsToParams(const Settings *s) {
+    return (FBMParams) {
+        .w = s->canvasWidth,
+        .h = s->canvasHeight,
+        .z = s->zoff,
+        .xoff = s->xoff,
+        .yoff = s->yoff,
+        .scale = s->scale,
+        .lacunarity = s->lacunarity,
+        .gain = s->gain,
+        .octaves = s->octaves,
+        .normalize = (NormalizeMode)s->normalize,
+        .seed = (unsigned int)s->seed
+    };
+}
+
+static void ParseSettingsArgs(Settings *out) {
+#define X(TYPE, NAME, DEFAULT) \
+    if (sargs_exists(#NAME)) \
+        out->NAME = (TYPE)atof(sargs_value(#NAME));
+    SETTINGS
+#undef X
+}
+
+// Everything one generated frame is drawn into. dirty flags the texture
+// tiles where bitmap differs from the canvas on screen
 typedef struct {
-    Vec4 color;
-    float max;
-    char buffer[64];
-    int bufferLength;
-    int index;
-} BiomeData;
-
-typedef struct biome {
-    BiomeData data;
-    struct biome *next;
-} Biome;
+    float *heightmap;
+    Bitmap bitmap;
+    Bitmap normals, slopes;
+    bool *dirty;
+} Canvas;
+
+// Canvases are carved out of one arena, sized once per canvas size so
+// regenerating never allocates. The normal and slope maps are only carved
+// out when surfaceMaps is on, otherwise they're zeroed
+static void AllocCanvases(Arena *arena, int w, int h, bool maps, Canvas *canvases, int count) {
+    size_t plane = (size_t)w * h, tiles = (size_t)TEXTURE_TILES(w) * TEXTURE_TILES(h);
+    ArenaReserve(arena, count * (plane * sizeof(float) + (maps ? 3 : 1) * plane * sizeof(int) + tiles + 5 * ARENA_ALIGN));
+    for (int i = 0; i < count; i++) {
+        Canvas *canvas = &canvases[i];
+        canvas->heightmap = ArenaAlloc(arena, plane * sizeof(float));
+        canvas->dirty = ArenaAlloc(arena, tiles * sizeof(bool));
+        canvas->bitmap = (Bitmap) {
+            .buf = ArenaAlloc(arena, plane * sizeof(int)),
+            .w = w,
+            .h = h
+        };
+        canvas->normals = canvas->slopes = (Bitmap) {0};
+        if (maps) {
+            canvas->normals = (Bitmap) { .buf = ArenaAlloc(arena, plane * sizeof(int)), .w = w, .h = h };
+            canvas->slopes = (Bitmap) { .buf = ArenaAlloc(arena, plane * sizeof(int)), .w = w, .h = h };
+        }
+    }
+}
+
+static bool GenerateCanvas(FBM *fbm, const FBMParams *params, Canvas *canvas) {
+    FBMMaps maps = {
+        .normals = canvas->normals.buf,
+        .slopes = canvas->slopes.buf
+    };
+    return FBMGenerateMaps(fbm, params, canvas->heightmap, canvas->normals.buf ? &maps : NULL);
+}
+
+#if !WEB_BUILD
+// Queued when a queue is given, otherwise written before returning, false
+// if either layer couldn't be
+static bool ExportSurfaceMaps(ExportQueue *queue, Bitmap *normals, Bitmap *slopes, const char *path, int level) {
+    Bitmap *maps[] = { normals, slopes };
+    const char *suffixes[] = { "normal", "slope" };
+    bool ok = true;
+    for (int i = 0; i < 2; i++) {
+        if (!maps[i]->buf)
+            continue;
+        char layer[1024];
+        BitmapLayerPath(path, suffixes[i], layer, sizeof(layer));
+        if (queue)
+            ExportQueueBitmap(queue, maps[i], layer, PNG_AUTO, level);
+        else
+            ok = ExportBitmapPNG(maps[i], layer, PNG_AUTO, level) && ok;
+    }
+    return ok;
+}
+#endif
+
+#if !WEB_BUILD
+// Stale renders are only abandoned if the screen changed within this many
+// seconds, so a long drag still shows intermediate results
+#define MAX_DISPLAY_LAG .25
+// Previews are rendered at 1/2^level resolution, level 0 is the full canvas
+#define MAX_PREVIEW_LEVEL 3
 
+// Generation runs on its own thread, drawing into the back canvas while the
+// front one is on screen. frame() only posts the latest settings and swaps
+// the canvases once a render is ready, so it never waits on the noise.
+// Requests start at a coarse preview level and refine one level at a time
+// down to last, so previews stop short of full resolution
 typedef struct {
-    int count, tally;
-    Biome *head, *tail;
-} BiomeTree;
+    thrd_t thread;
+    mtx_t lock;
+    cnd_t wake, idle;
+    bool quit, hold, busy, ready, cancelled;
+    unsigned int requested, started;
+    int next, last, level;
+    Settings settings;
+    int palette[256];
+    double lastSwap, time;
+    size_t cache;
+} Generator;
+#endif
 
 static struct {
     sg_pass_action pass_action;
-    Vertex vertices[6];
-    Bitmap bitmap;
-    Texture texture;
+    // A quad per texture tile, then one covering the whole canvas
+    Vertex *vertices;
+    int quadCapacity;
+    // Desktop builds render into canvas[!front] on the generator thread
+    Canvas canvas[2];
+    int front;
+    TiledTexture texture;
+    int uploaded;
+    World *world;
+    int worldMode;
+    // Full resolution renders and world tiles kept across runs, or NULL
+    DiskCache *disk;
+#if !WEB_BUILD
+    // Level l's preview is previews[l-1], shown is the level on screen
+    Canvas previews[MAX_PREVIEW_LEVEL];
+    Texture previewTextures[MAX_PREVIEW_LEVEL];
+    Arena previewArena;
+    FBM previewFbm;
+    int shown;
+    bool editing;
+#endif
+    FBM fbm;
+    Arena arena;
     float delta;
     bool update;
     bool dragging;
@@ -105,12 +245,22 @@ static struct {
     int currentModel;
     const char **scripts;
     int currentScript;
-    lua_State *luaState;
-    mtx_t luaStateLock;
+    // Only held to swap lua or count its users, never while a script runs
+    LuaPool *lua;
+    mtx_t luaLock;
+    ExportQueue *exports;
+    Generator generator;
 #endif
 } state;
 
 #if !WEB_BUILD
+#define CANVAS_COUNT 2
+#else
+#define CANVAS_COUNT 1
+#endif
+
+#if !WEB_BUILD
+/* Only registered on control states, so this only runs on the UI thread */
 int LuaSettings(lua_State *L) {
     const char *setting = luaL_checkstring(L, 1);
     
@@ -118,7 +268,6 @@ int LuaSettings(lua_State *L) {
 #define X(TYPE, NAME, DEFAULT)                            \
         if (!strcmp(setting, #NAME)) {                    \
             lua_pushnumber(L, (lua_Number)settings.NAME); \
-            state.update = true;                          \
             return 1;                                     \
         }
         SETTINGS
@@ -126,10 +275,15 @@ int LuaSettings(lua_State *L) {
         luaL_error(L, "Unknown setting: '%s'", setting);
         return 0;
     }
-#define X(TYPE, NAME, DEFAULT)                        \
-    if (!strcmp(setting, #NAME)) {                    \
-        settings.NAME = (TYPE)luaL_checknumber(L, 2); \
-        return 0;                                     \
+    /* frame() compares against settings after preframe, so flag it here */
+#define X(TYPE, NAME, DEFAULT)                          \
+    if (!strcmp(setting, #NAME)) {                      \
+        TYPE value = (TYPE)luaL_checknumber(L, 2);      \
+        if (value != settings.NAME) {                   \
+            settings.NAME = value;                      \
+            state.update = true;                        \
+        }                                               \
+        return 0;                                       \
     }
     SETTINGS
 #undef X
@@ -142,6 +296,38 @@ int LuaDelta(lua_State *L) {
     return 1;
 }
 
+/* The current pool, kept alive until ReleaseLua even if it's swapped out */
+static LuaPool* AcquireLua(void) {
+    mtx_lock(&state.luaLock);
+    LuaPool *pool = state.lua;
+    if (pool)
+        pool->users++;
+    mtx_unlock(&state.luaLock);
+    return pool;
+}
+
+static void ReleaseLua(LuaPool *pool) {
+    if (!pool)
+        return;
+    mtx_lock(&state.luaLock);
+    bool retired = !--pool->users && pool != state.lua;
+    mtx_unlock(&state.luaLock);
+    if (retired)
+        DestroyLuaPool(pool);
+}
+
+/* The old pool is destroyed here if nobody's using it, or by its last user */
+static void SwapLua(LuaPool *pool) {
+    mtx_lock(&state.luaLock);
+    LuaPool *old = state.lua;
+    state.lua = pool;
+    state.update = true;
+    bool retired = old && !old->users;
+    mtx_unlock(&state.luaLock);
+    if (retired)
+        DestroyLuaPool(old);
+}
+
 static void WatchCallback(dmon_watch_id watch_id, dmon_action action, const char *dirname, const char *filename, const char *oldname, void *user) {
     const char *ext = FileExt(filename);
     if (!ext)
@@ -175,10 +361,9 @@ static void WatchCallback(dmon_watch_id watch_id, dmon_action action, const char
                 if (!state.currentScript)
                     return;
                 if (!strcmp(filename, state.scripts[state.currentScript-1])) {
-                    mtx_lock(&state.luaStateLock);
-                    lua_close(state.luaState);
-                    state.luaState = LoadLuaScript(state.scripts[state.currentScript-1]);
-                    mtx_unlock(&state.luaStateLock);
+                    // Load the new pool before swapping so renders only
+                    // ever see the old pool or the new one
+                    SwapLua(NewLuaPool(filename, 0));
                 }
             }
             break;
@@ -189,11 +374,8 @@ static void WatchCallback(dmon_watch_id watch_id, dmon_action action, const char
                         free((void*)state.scripts[i]);
                         VectorRemove(state.scripts, i);
                         if (state.currentScript - 1 == i) {
-                            mtx_lock(&state.luaStateLock);
-                            lua_close(state.luaState);
-                            state.luaState = NULL;
+                            SwapLua(NULL);
                             state.currentScript = 0;
-                            mtx_unlock(&state.luaStateLock);
                         }
                     }
             }
@@ -203,8 +385,307 @@ static void WatchCallback(dmon_watch_id watch_id, dmon_action action, const char
             break;
     }
 }
+
+/* 1/8 resolution once the canvas is past 1024², 1/4 below that */
+static int PreviewLevel(const Settings *s) {
+    return (size_t)s->canvasWidth * s->canvasHeight > 1024 * 1024 ? 3 : 2;
+}
+
+/* The same view sampled every 2^level pixels, without surface maps */
+static Settings PreviewSettings(const Settings *s, int level) {
+    Settings out = *s;
+    if (!level)
+        return out;
+    float k = (float)(1 << level);
+    out.canvasWidth = MAX(s->canvasWidth >> level, 1);
+    out.canvasHeight = MAX(s->canvasHeight >> level, 1);
+    out.xoff = s->xoff / k;
+    out.yoff = s->yoff / k;
+    out.scale = s->scale / k;
+    out.surfaceMaps = 0;
+    return out;
+}
+
+static void AllocPreviews(Arena *arena, int w, int h, Canvas *previews) {
+    size_t total = 0;
+    for (int l = 1; l <= MAX_PREVIEW_LEVEL; l++)
+        total += (size_t)MAX(w >> l, 1) * MAX(h >> l, 1) * (sizeof(float) + sizeof(int)) + 2 * ARENA_ALIGN;
+    ArenaReserve(arena, total);
+    for (int l = 1; l <= MAX_PREVIEW_LEVEL; l++) {
+        int pw = MAX(w >> l, 1), ph = MAX(h >> l, 1);
+        previews[l-1] = (Canvas) {
+            .heightmap = ArenaAlloc(arena, (size_t)pw * ph * sizeof(float)),
+            .bitmap = {
+                .buf = ArenaAlloc(arena, (size_t)pw * ph * sizeof(int)),
+                .w = pw,
+                .h = ph
+            }
+        };
+    }
+}
+
+/* Everything that goes into a finished render: the settings, the palette
+   and the source of the script run over it */
+static uint64_t CanvasKey(const Settings *s, const int *palette, uint64_t script) {
+    /* Export only settings don't change the render, so leave them out */
+    Settings keyed = *s;
+    keyed.pngLevel = 0;
+    uint64_t hash = CACHE_HASH_INIT;
+#define X(TYPE, NAME, DEFAULT) hash = CacheHash(hash, &keyed.NAME, sizeof(keyed.NAME));
+    SETTINGS
+#undef X
+    hash = CacheHash(hash, palette, 256 * sizeof(int));
+    return CacheHash(hash, &script, sizeof(script));
+}
+
+/* Heights, colours then the surface maps if there are any */
+static int CanvasParts(Canvas *canvas, void **parts, size_t *sizes) {
+    size_t plane = (size_t)canvas->bitmap.w * canvas->bitmap.h;
+    void *all[] = { canvas->heightmap, canvas->bitmap.buf, canvas->normals.buf, canvas->slopes.buf };
+    int count = canvas->normals.buf ? 4 : 2;
+    for (int i = 0; i < count; i++) {
+        parts[i] = all[i];
+        sizes[i] = plane * (i ? sizeof(int) : sizeof(float));
+    }
+    return count;
+}
+
+/* Runs on the generator thread, false if it was cancelled part way. With a
+   disk cache a render seen before is mapped back in instead, Lua and all */
+static bool RenderCanvas(FBM *fbm, DiskCache *disk, const Settings *s, const int *palette, Canvas *canvas) {
+    /* Requests posted before a resize finished don't fit the new canvases */
+    if (s->canvasWidth != canvas->bitmap.w || s->canvasHeight != canvas->bitmap.h ||
+        !s->surfaceMaps != !canvas->normals.buf)
+        return false;
+    void *parts[4];
+    size_t sizes[4], total = 0;
+    int count = CanvasParts(canvas, parts, sizes);
+    for (int i = 0; i < count; i++)
+        total += sizes[i];
+    LuaPool *lua = AcquireLua();
+    uint64_t key = CanvasKey(s, palette, lua ? lua->hash : 0);
+    CachedBlob cached;
+    if (DiskCacheMap(disk, key, total, &cached)) {
+        const char *src = cached.data;
+        for (int i = 0; i < count; src += sizes[i++])
+            memcpy(parts[i], src, sizes[i]);
+        DiskCacheUnmap(&cached);
+        ReleaseLua(lua);
+        return true;
+    }
+    
+    double start = Timestamp();
+    FBMParams params = SettingsToParams(s);
+    if (!GenerateCanvas(fbm, &params, canvas)) {
+        ReleaseLua(lua);
+        return false;
+    }
+    /* One pool for the whole render, even if a new one is swapped in */
+    if (lua)
+        LuaPoolCallFrame(lua, canvas->heightmap, canvas->bitmap.w, canvas->bitmap.h);
+    ApplyPalette(palette, canvas->heightmap, &canvas->bitmap);
+    if (lua)
+        LuaPoolCallPostframe(lua, &canvas->bitmap);
+    ReleaseLua(lua);
+    /* Snapped pans aren't quite what the settings ask for */
+    bool exact = fbm->params.xoff == params.xoff && fbm->params.yoff == params.yoff;
+    if (exact && Timestamp() - start >= DISK_CACHE_MIN_TIME)
+        DiskCacheStore(disk, key, (const void**)parts, sizes, count);
+    return true;
+}
+
+/* FBM's cancel hook, latched so a render never resumes once it's given up */
+static bool GeneratorCancelled(void *userdata) {
+    Generator *gen = (Generator*)userdata;
+    mtx_lock(&gen->lock);
+    if (gen->quit || gen->hold ||
+        (gen->started != gen->requested && Timestamp() - gen->lastSwap < MAX_DISPLAY_LAG))
+        gen->cancelled = true;
+    bool cancelled = gen->cancelled;
+    mtx_unlock(&gen->lock);
+    return cancelled;
+}
+
+static int GeneratorThread(void *arg) {
+    Generator *gen = (Generator*)arg;
+    mtx_lock(&gen->lock);
+    for (;;) {
+        while (!gen->quit && (gen->ready || gen->hold || gen->next < gen->last))
+            cnd_wait(&gen->wake, &gen->lock);
+        if (gen->quit)
+            break;
+        int level = gen->next;
+        Settings request = PreviewSettings(&gen->settings, level);
+        int palette[256];
+        memcpy(palette, gen->palette, sizeof(palette));
+        Canvas *canvas = level ? &state.previews[level-1] : &state.canvas[!state.front];
+        Canvas *front = &state.canvas[state.front];
+        FBM *fbm = level ? &state.previewFbm : &state.fbm;
+        gen->started = gen->requested;
+        gen->cancelled = false;
+        gen->busy = true;
+        mtx_unlock(&gen->lock);
+        
+        double start = Timestamp();
+        bool done = RenderCanvas(fbm, level ? NULL : state.disk, &request, palette, canvas);
+        if (done && !level)
+            BitmapDiffTiles(&canvas->bitmap, &front->bitmap, canvas->dirty);
+        size_t cache = (state.fbm.gridCapacity + state.fbm.layerCapacity) * sizeof(float);
+        
+        mtx_lock(&gen->lock);
+        gen->busy = false;
+        gen->cache = cache;
+        if (done) {
+            gen->ready = true;
+            gen->level = level;
+            gen->time = Timestamp() - start;
+        }
+        /* A newer request has already reset next */
+        if (gen->started == gen->requested)
+            gen->next = done ? level - 1 : -1;
+        cnd_broadcast(&gen->idle);
+    }
+    mtx_unlock(&gen->lock);
+    return 0;
+}
+
+static void StartGenerator(Generator *gen) {
+    mtx_init(&gen->lock, mtx_plain);
+    cnd_init(&gen->wake);
+    cnd_init(&gen->idle);
+    thrd_create(&gen->thread, GeneratorThread, gen);
+}
+
+// Replaces any request that hasn't started, and cancels one that has.
+// Previews stop at the coarse level until GeneratorRefine is called
+static void GeneratorPost(Generator *gen, const Settings *settings, const int *palette, bool preview) {
+    mtx_lock(&gen->lock);
+    gen->settings = *settings;
+    memcpy(gen->palette, palette, sizeof(gen->palette));
+    gen->next = PreviewLevel(settings);
+    gen->last = preview ? gen->next : 0;
+    gen->requested++;
+    cnd_signal(&gen->wake);
+    mtx_unlock(&gen->lock);
+}
+
+// Carries the current request on down to full resolution
+static void GeneratorRefine(Generator *gen) {
+    mtx_lock(&gen->lock);
+    gen->last = 0;
+    cnd_signal(&gen->wake);
+    mtx_unlock(&gen->lock);
+}
+
+// The level of a finished render, -1 if there isn't one. Its canvas stays
+// untouched until GeneratorPresent, so it can be uploaded in between
+static int GeneratorFinished(Generator *gen) {
+    mtx_lock(&gen->lock);
+    int level = gen->ready ? gen->level : -1;
+    mtx_unlock(&gen->lock);
+    return level;
+}
+
+// Hands the finished render's canvas back, flipping the canvases for level 0
+static void GeneratorPresent(Generator *gen) {
+    mtx_lock(&gen->lock);
+    if (!gen->level)
+        state.front = !state.front;
+    gen->ready = false;
+    gen->lastSwap = Timestamp();
+    cnd_signal(&gen->wake);
+    mtx_unlock(&gen->lock);
+}
+
+// Stops the thread touching the canvases, dropping any finished render
+static void PauseGenerator(Generator *gen) {
+    mtx_lock(&gen->lock);
+    gen->hold = true;
+    while (gen->busy)
+        cnd_wait(&gen->idle, &gen->lock);
+    gen->ready = false;
+    mtx_unlock(&gen->lock);
+}
+
+static void ResumeGenerator(Generator *gen) {
+    mtx_lock(&gen->lock);
+    gen->hold = false;
+    cnd_signal(&gen->wake);
+    mtx_unlock(&gen->lock);
+}
+
+static void StopGenerator(Generator *gen) {
+    mtx_lock(&gen->lock);
+    gen->quit = true;
+    cnd_signal(&gen->wake);
+    mtx_unlock(&gen->lock);
+    thrd_join(gen->thread, NULL);
+    cnd_destroy(&gen->wake);
+    cnd_destroy(&gen->idle);
+    mtx_destroy(&gen->lock);
+}
+
+static void UploadPreview(int level) {
+    Canvas *preview = &state.previews[level-1];
+    sg_update_image(state.previewTextures[level-1], &(sg_image_data) {
+        .subimage[0][0] = {
+            .ptr  = preview->bitmap.buf,
+            .size = preview->bitmap.w * preview->bitmap.h * sizeof(int)
+        }
+    });
+}
 #endif
 
+// Grows the vertex buffer to hold at least quads quads
+static void ReserveQuads(int quads) {
+    if (quads <= state.quadCapacity)
+        return;
+    state.quadCapacity = quads;
+    state.vertices = realloc(state.vertices, quads * 6 * sizeof(Vertex));
+    if (state.camera2d.binding.vertex_buffers[0].id)
+        sg_destroy_buffer(state.camera2d.binding.vertex_buffers[0]);
+    state.camera2d.binding.vertex_buffers[0] = sg_make_buffer(&(sg_buffer_desc) {
+        .usage = SG_USAGE_STREAM,
+        .size = quads * 6 * sizeof(Vertex)
+    });
+}
+
+// Recreates the tiled texture, with room for a quad per tile
+static void MakeCanvasTexture(int w, int h) {
+    DestroyTiledTexture(&state.texture);
+    state.texture = NewTiledTexture(w, h);
+    ReserveQuads(state.texture.columns * state.texture.rows + 1);
+}
+
+/* Two triangles covering size pixels at position, y down, in clip space */
+static void QuadVertices(Vertex *out, Vec2 position, Vec2 size, Vec2 viewport, float zoom) {
+    Vec2 quad[4] = {
+        {position.x, position.y + size.y}, // bottom left
+        position + size, // bottom right
+        {position.x + size.x, position.y }, // top right
+        position, // top left
+    };
+    Vec2 v = (Vec2){2.f,-2.f} / viewport;
+    for (int j = 0; j < 4; j++)
+        quad[j] = (v * quad[j] + (Vec2){-1.f, 1.f}) * zoom;
+    
+    static const Vec2 vtexquad[4] = {
+        {0.f, 1.f}, // bottom left
+        {1.f, 1.f}, // bottom right
+        {1.f, 0.f}, // top right
+        {0.f, 0.f}, // top left
+    };
+    static const int indices[6] = {
+        0, 1, 2,
+        3, 0, 2
+    };
+    for (int i = 0; i < 6; i++)
+        out[i] = (Vertex) {
+            .position = V2TOV4(quad[indices[i]]),
+            .texcoord = vtexquad[indices[i]]
+        };
+}
+
 void init(void) {
     sg_setup(&(sg_desc){
         .context = sapp_sgcontext()
@@ -216,14 +697,19 @@ void init(void) {
         .colors[0] = { .action=SG_ACTION_CLEAR, .value={.1f, .1f, .1f, 1.f} }
     };
     
-#define X(TYPE, NAME, DEFAULT) \
-    if (sargs_exists(#NAME)) \
-        settings.NAME = (TYPE)atof(sargs_value(#NAME));
-    SETTINGS
-#undef X
+    ParseSettingsArgs(&settings);
     
-    state.texture = NewTexture(settings.canvasWidth, settings.canvasHeight);
-    state.bitmap = NewBitmap(settings.canvasWidth, settings.canvasHeight);
+    state.fbm = NewFBM();
+    state.fbm.layerBudget = (size_t)(sargs_exists("layerBudget") ? atoi(sargs_value("layerBudget")) : DEFAULT_LAYER_BUDGET) << 20;
+    /* Scripts scroll by fractions of a pixel every frame */
+    state.fbm.snapPans = true;
+#if !WEB_BUILD
+    size_t diskBudget = (size_t)(sargs_exists("diskBudget") ? atoi(sargs_value("diskBudget")) : DEFAULT_DISK_BUDGET) << 20;
+    state.disk = diskBudget ? NewDiskCache(sargs_value_def("cacheDir", DEFAULT_CACHE_DIR), diskBudget) : NULL;
+#endif
+    state.world = NewWorld((size_t)(sargs_exists("worldBudget") ? atoi(sargs_value("worldBudget")) : DEFAULT_WORLD_BUDGET) << 20, state.disk);
+    AllocCanvases(&state.arena, settings.canvasWidth, settings.canvasHeight, settings.surfaceMaps, state.canvas, CANVAS_COUNT);
+    state.front = 0;
     state.update = true;
     state.camera2d.zoom = 1.f;
     state.camera2d.position = (Vec2){0.f, 0.f};
@@ -236,8 +722,20 @@ void init(void) {
     state.currentModel = 0;
     state.scripts = FindFiles("lua");
     state.currentScript = 0;
-    state.luaState = NULL;
-    mtx_init(&state.luaStateLock, mtx_plain);
+    state.lua = NULL;
+    mtx_init(&state.luaLock, mtx_plain);
+    state.exports = NewExportQueue(2);
+    state.fbm.cancel = GeneratorCancelled;
+    state.fbm.cancelData = &state.generator;
+    state.previewFbm = NewFBM();
+    state.previewFbm.snapPans = true;
+    state.previewFbm.cancel = GeneratorCancelled;
+    state.previewFbm.cancelData = &state.generator;
+    AllocPreviews(&state.previewArena, settings.canvasWidth, settings.canvasHeight, state.previews);
+    for (int i = 0; i < MAX_PREVIEW_LEVEL; i++)
+        state.previewTextures[i] = NewTexture(state.previews[i].bitmap.w, state.previews[i].bitmap.h);
+    state.generator.next = -1;
+    StartGenerator(&state.generator);
     
     dmon_init();
     assert(DoesDirExist("assets"));
@@ -256,166 +754,15 @@ void init(void) {
         }
     });
     
-    state.camera2d.binding = (sg_bindings) {
-        .fs_images[SLOT_tex] = state.texture,
-        .vertex_buffers[0] = sg_make_buffer(&(sg_buffer_desc) {
-            .usage = SG_USAGE_STREAM,
-            .size = 6 * sizeof(Vertex)
-        })
-    };
-}
-
-
-static void SwapBiomes(Biome *a, Biome *b) {
-    BiomeData tmp;
-    memcpy(&tmp, &a->data, sizeof(BiomeData));
-    memcpy(&a->data, &b->data, sizeof(BiomeData));
-    memcpy(&b->data, &tmp, sizeof(BiomeData));
-}
-
-static bool SortBiomes(void) {
-    Biome *cursor = state.biomes.head;
-    Biome *tmp = NULL;
-    bool sorted = false;
-    while (cursor) {
-        tmp = cursor->next;
-        while (tmp) {
-            if (cursor->data.max > tmp->data.max) {
-                SwapBiomes(cursor, tmp);
-                sorted = true;
-            }
-            tmp = tmp->next;
-        }
-        cursor = cursor->next;
-    }
-    return sorted;
-}
-
-#define MAX_BIOMES 16
-
-static void AddNewBiome(Vec4 color, float max) {
-    if (state.biomes.count >= MAX_BIOMES)
-        return;
-    
-    Biome *result = malloc(sizeof(Biome));
-    result->data = (BiomeData) {
-        .color = color,
-        .max   = max,
-        .index = ++state.biomes.tally,
-        .bufferLength = 0
-    };
-    memset(&result->data.buffer, 0, 64);
-    memcpy(&result->data.buffer, "0", sizeof(unsigned char));
-    result->next  = NULL;
-    
-    state.biomes.count++;
-    if (!state.biomes.head)
-        state.biomes.head = state.biomes.tail = result;
-    else
-        state.biomes.tail = state.biomes.tail->next = result;
-    
-    SortBiomes();
+    MakeCanvasTexture(settings.canvasWidth, settings.canvasHeight);
 }
 
-static void RemoveBiome(Biome *biome) {
-    Biome *cursor = state.biomes.head, *prev = NULL;
-    while (cursor) {
-        if (cursor->data.index == biome->data.index) {
-            if (!prev)
-                state.biomes.head = cursor->next;
-            else
-                prev->next = cursor->next;
-            state.biomes.count--;
-            free(cursor);
-            break;
-        }
-        prev = cursor;
-        cursor = cursor->next;
-    }
-}
-
-static int ColorToRGB(Vec4 color) {
-    return RGBA((int)(color.x * 255.f), (int)(color.y * 255.f), (int)(color.z * 255.f), (int)(color.w * 255));
-}
-
-static void DestroyBiomes(void) {
-    Biome *cursor = state.biomes.head;
-    while (cursor) {
-        Biome *tmp = cursor->next;
-        free(cursor);
-        cursor = tmp;
-    }
-}
 
 #if !WEB_BUILD
-static void ExportBiomes(const char *path) {
-    FILE *fh = fopen(path, "w");
-    Jim jim = {
-        .sink = fh,
-        .write = (Jim_Write)fwrite
-    };
-    jim_object_begin(&jim);
-    jim_member_key(&jim, "biomes");
-    jim_array_begin(&jim);
-    Biome *cursor = state.biomes.head;
-    while (cursor) {
-        jim_object_begin(&jim);
-        jim_member_key(&jim, "r");
-        jim_integer(&jim, (long long)(cursor->data.color.x * 255.f));
-        jim_member_key(&jim, "g");
-        jim_integer(&jim, (long long)(cursor->data.color.y * 255.f));
-        jim_member_key(&jim, "b");
-        jim_integer(&jim, (long long)(cursor->data.color.z * 255.f));
-        jim_member_key(&jim, "a");
-        jim_integer(&jim, (long long)(cursor->data.color.w * 255.f));
-        jim_member_key(&jim, "max");
-        jim_float(&jim, (double)cursor->data.max, 2);
-        jim_object_end(&jim);
-        cursor = cursor->next;
-    }
-    jim_array_end(&jim);
-    jim_object_end(&jim);
-    fclose(fh);
-}
-
-static void LoadBiomes(const char *path) {
-    if (state.biomes.head)
-        DestroyBiomes();
-    
-    int colorR[MAX_BIOMES];
-    int colorG[MAX_BIOMES];
-    int colorB[MAX_BIOMES];
-    int colorA[MAX_BIOMES];
-    double max[MAX_BIOMES];
-    const struct json_attr_t biome_attr[] = {
-        {"r", t_integer, .addr.integer=colorR},
-        {"g", t_integer, .addr.integer=colorG},
-        {"b", t_integer, .addr.integer=colorB},
-        {"a", t_integer, .addr.integer=colorA},
-        {"max", t_real, .addr.real=max},
-        {NULL}
-    };
-    int biomeCount = 0;
-    const struct json_attr_t root_attr[] = {
-        {"biomes", t_array, .addr.array.element_type=t_object,
-                            .addr.array.arr.objects.subtype=biome_attr,
-                            .addr.array.maxlen=MAX_BIOMES,
-                            .addr.array.count=&biomeCount},
-        {NULL}
-    };
-    
-    char *json = LoadFile(path, NULL);
-    assert(json);
-    int status = json_read_object(json, root_attr, NULL);
-    assert(!status);
-    assert(biomeCount);
-    
-    for (int i = 0; i < biomeCount; i++)
-        AddNewBiome((Vec4){(float)colorR[i] / 255.f, (float)colorG[i] / 255.f, (float)colorB[i] / 255.f, (float)colorA[i] / 255.f}, max[i]);
-}
-
-static void ExportSettings(const char *path) {
+static bool ExportSettings(const Settings *s, const char *path) {
     FILE *fh = fopen(path, "w");
+    if (!fh)
+        return false;
     Jim jim = {
         .sink = fh,
         .write = (Jim_Write)fwrite
@@ -425,20 +772,79 @@ static void ExportSettings(const char *path) {
     jim_object_begin(&jim);
 #define X(TYPE, NAME, DEFAULT)   \
     jim_member_key(&jim, #NAME); \
-    jim_float(&jim,  (float)settings.NAME, 2);
+    jim_float(&jim,  (float)s->NAME, 2);
     SETTINGS
 #undef X
     jim_object_end(&jim);
     jim_object_end(&jim);
-    fclose(fh);
+    return !fclose(fh) && jim.error == JIM_OK;
+}
+
+static bool RunSettingsExport(ExportJob *job) {
+    return ExportSettings((Settings*)job->data, job->path);
+}
+
+static bool RunBiomesExport(ExportJob *job) {
+    return ExportBiomes((BiomeTree*)job->data, job->path);
+}
+
+static void ReleaseBiomesExport(void *data) {
+    DestroyBiomes((BiomeTree*)data);
+    free(data);
+}
+
+// Settings and biomes are tiny, so they're snapshotted by copying
+static void QueueSettingsExport(ExportQueue *queue, const char *path) {
+    Settings *copy = malloc(sizeof(Settings));
+    memcpy(copy, &settings, sizeof(Settings));
+    ExportQueuePush(queue, path, RunSettingsExport, copy, free);
+}
+
+static void QueueBiomesExport(ExportQueue *queue, BiomeTree *tree, const char *path) {
+    BiomeTree *copy = calloc(1, sizeof(BiomeTree));
+    for (Biome *cursor = tree->head; cursor; cursor = cursor->next)
+        AddNewBiome(copy, cursor->data.color, cursor->data.max);
+    ExportQueuePush(queue, path, RunBiomesExport, copy, ReleaseBiomesExport);
 }
 
-static void LoadSettings(const char *path, Settings *out) {
+/* Only the header's page of a mapped heightmap is read */
+static bool LoadMappedSettings(const char *path, Settings *out) {
+    MappedHeightmap map;
+    if (!OpenMappedHeightmap(path, &map))
+        return false;
+    const MappedHeightmapHeader *header = map.header;
+    out->canvasWidth = header->w;
+    out->canvasHeight = header->h;
+    out->xoff = header->xoff;
+    out->yoff = header->yoff;
+    out->zoff = header->z;
+    out->scale = header->scale;
+    out->lacunarity = header->lacunarity;
+    out->gain = header->gain;
+    out->octaves = header->octaves;
+    out->normalize = header->normalize;
+    out->seed = header->seed;
+    CloseMappedHeightmap(&map);
+    return true;
+}
+
+/* out is left untouched if the file is missing or malformed */
+static bool LoadSettings(const char *path, Settings *out) {
+    if (MappedHeightmapFormat(path, NULL)) {
+        if (LoadMappedSettings(path, out))
+            return true;
+        fprintf(stderr, "ERROR: '%s' isn't a mapped heightmap\n", path);
+        return false;
+    }
     struct {
 #define X(TYPE, NAME, DEFAULT) double NAME;
         SETTINGS
 #undef X
-    } tmp;
+    } tmp = {
+#define X(TYPE, NAME, DEFAULT) .NAME = (double)out->NAME,
+        SETTINGS
+#undef X
+    };
     
     const struct json_attr_t settings_attr[] = {
 #define X(TYPE, NAME, DEFAULT) { #NAME, t_real, .addr.real=&tmp.NAME },
@@ -452,26 +858,351 @@ static void LoadSettings(const char *path, Settings *out) {
     };
     
     char *json = LoadFile(path, NULL);
-    assert(json);
+    if (!json) {
+        fprintf(stderr, "ERROR: Failed to load settings '%s'\n", path);
+        return false;
+    }
     int status = json_read_object(json, root_attr, NULL);
-    assert(!status);
+    free(json);
+    if (status) {
+        fprintf(stderr, "ERROR: Failed to parse settings '%s': %s\n", path, json_error_string(status));
+        return false;
+    }
     
 #define X(TYPE, NAME, DEFAULT) out->NAME = (TYPE)tmp.NAME;
     SETTINGS
 #undef X
+    return true;
+}
+
+typedef struct {
+    char name[256];
+    LuaPool *lua;
+} HeadlessScript;
+
+// Buffers and Lua states that headless jobs reuse between runs, one per
+// manifest worker so jobs share nothing but the job pool
+typedef struct {
+    Settings settings;
+    FBM fbm;
+    Arena arena;
+    Canvas canvas;
+    BiomeTree biomes;
+    char biomesPath[256];
+    HeadlessScript *scripts;
+} HeadlessContext;
+
+static void DestroyHeadlessContext(HeadlessContext *ctx) {
+    for (int i = 0; i < VectorCount(ctx->scripts); i++)
+        DestroyLuaPool(ctx->scripts[i].lua);
+    DestroyVector(ctx->scripts);
+    DestroyArena(&ctx->arena);
+    DestroyFBM(&ctx->fbm);
+    DestroyBiomes(&ctx->biomes);
+}
+
+static LuaPool* HeadlessLoadScript(HeadlessContext *ctx, const char *name) {
+    if (!name || !name[0])
+        return NULL;
+    for (int i = 0; i < VectorCount(ctx->scripts); i++)
+        if (!strcmp(ctx->scripts[i].name, name))
+            return ctx->scripts[i].lua;
+    HeadlessScript script = {
+        .lua = NewLuaPool(name, 0)
+    };
+    strncpy(script.name, name, sizeof(script.name) - 1);
+    VectorAppend(ctx->scripts, script);
+    return script.lua;
+}
+
+/* Generated a block at a time straight into the mapped file, so the whole
+   map is never in memory. Blocks have to agree on their range, so heights
+   are always globally normalized, and only the heights are written */
+static int HeadlessRunMapped(HeadlessContext *ctx, HeightFormat format, const char *output) {
+    FBMParams params = SettingsToParams(&ctx->settings);
+    params.normalize = NORMALIZE_GLOBAL;
+    MappedHeightmap map;
+    if (!NewMappedHeightmap(output, params.w, params.h, format, &params, &map)) {
+        fprintf(stderr, "ERROR: Failed to write '%s'\n", output);
+        return 1;
+    }
+    float *heights = malloc(MAPPED_EXPORT_TILE * MAPPED_EXPORT_TILE * sizeof(float));
+    for (int y = 0; y < params.h; y += MAPPED_EXPORT_TILE)
+        for (int x = 0; x < params.w; x += MAPPED_EXPORT_TILE) {
+            FBMParams tile = params;
+            tile.w = MIN(MAPPED_EXPORT_TILE, params.w - x);
+            tile.h = MIN(MAPPED_EXPORT_TILE, params.h - y);
+            tile.xoff += x;
+            tile.yoff += y;
+            FBMGenerate(&ctx->fbm, &tile, heights);
+            MappedHeightmapWrite(&map, heights, x, y, tile.w, tile.h);
+        }
+    free(heights);
+    CloseMappedHeightmap(&map);
+    return 0;
+}
+
+static int HeadlessRun(HeadlessContext *ctx, const char *biomes, const char *script, const char *output) {
+    Settings *settings = &ctx->settings;
+    HeightFormat format;
+    if (MappedHeightmapFormat(output, &format)) {
+        if ((biomes && biomes[0]) || (script && script[0]) || settings->surfaceMaps)
+            fprintf(stderr, "WARNING: '%s' only holds heights, biomes, scripts and surface maps are skipped\n", output);
+        return HeadlessRunMapped(ctx, format, output);
+    }
+    bool enableBiomes = biomes && biomes[0];
+    if (enableBiomes && strcmp(ctx->biomesPath, biomes)) {
+        if (!LoadBiomes(&ctx->biomes, biomes))
+            return 1;
+        strncpy(ctx->biomesPath, biomes, sizeof(ctx->biomesPath) - 1);
+    }
+    LuaPool *lua = HeadlessLoadScript(ctx, script);
+    
+    FBMParams params = SettingsToParams(settings);
+    Canvas *canvas = &ctx->canvas;
+    if (canvas->bitmap.w != params.w || canvas->bitmap.h != params.h || !canvas->normals.buf != !settings->surfaceMaps)
+        AllocCanvases(&ctx->arena, params.w, params.h, settings->surfaceMaps, canvas, 1);
+    GenerateCanvas(&ctx->fbm, &params, canvas);
+    if (lua)
+        LuaPoolCallFrame(lua, canvas->heightmap, params.w, params.h);
     
+    if (!ExportSurfaceMaps(NULL, &canvas->normals, &canvas->slopes, output, settings->pngLevel)) {
+        fprintf(stderr, "ERROR: Failed to write the surface maps for '%s'\n", output);
+        return 1;
+    }
+    // Height formats skip colouring and write the float heights directly
+    if (HeightFormatFromPath(output, &format)) {
+        if (!ExportHeightmap(canvas->heightmap, params.w, params.h, format, output)) {
+            fprintf(stderr, "ERROR: Failed to write '%s'\n", output);
+            return 1;
+        }
+        return 0;
+    }
+    ColorHeightmap(&ctx->biomes, enableBiomes, canvas->heightmap, &canvas->bitmap);
+    if (lua)
+        LuaPoolCallPostframe(lua, &canvas->bitmap);
+    if (!ExportBitmapPNG(&canvas->bitmap, output, PNG_AUTO, settings->pngLevel)) {
+        fprintf(stderr, "ERROR: Failed to write '%s'\n", output);
+        return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    char settings[256];
+    char biomes[256];
+    char script[256];
+    char output[256];
+    int x, y;
+} ManifestJob;
+
+typedef struct {
+    ManifestJob *jobs;
+    int count, next, finished, failures;
+    Settings base;
+    mtx_t lock;
+} Manifest;
+
+typedef struct {
+    Manifest *manifest;
+    HeadlessContext ctx;
+    thrd_t thread;
+} ManifestWorker;
+
+/* Generation still queues on the shared job pool, what overlaps between
+   workers is everything after it: Lua, colouring, encoding and writing */
+static int ManifestWorkerThread(void *arg) {
+    ManifestWorker *worker = (ManifestWorker*)arg;
+    Manifest *manifest = worker->manifest;
+    HeadlessContext *ctx = &worker->ctx;
+    for (;;) {
+        mtx_lock(&manifest->lock);
+        int i = manifest->next++;
+        mtx_unlock(&manifest->lock);
+        if (i >= manifest->count)
+            break;
+        ManifestJob *job = &manifest->jobs[i];
+        double jobStart = Timestamp();
+        ctx->settings = manifest->base;
+        bool loaded = !job->settings[0] || LoadSettings(job->settings, &ctx->settings);
+        ctx->settings.xoff += job->x;
+        ctx->settings.yoff += job->y;
+        int result = loaded && job->output[0] ? HeadlessRun(ctx, job->biomes, job->script, job->output) : 1;
+        mtx_lock(&manifest->lock);
+        manifest->failures += result != 0;
+        printf("[%d/%d] %s %s in %.2f ms\n", ++manifest->finished, manifest->count, job->output[0] ? job->output : "(no output)",
+               result ? "FAILED" : "done", (Timestamp() - jobStart) * 1000.0);
+        mtx_unlock(&manifest->lock);
+    }
+    return 0;
+}
+
+// Run every job listed in a manifest in one process:
+//   {"jobs": [{"settings": "a.json", "biomes": "b.json", "script": "c.lua",
+//              "x": 0, "y": 0, "output": "tile_0_0.png"}, ...]}
+// Every field but output is optional, x/y are added to the job's xoff/yoff.
+// Jobs are shared between manifestWorkers threads, finishing in any order
+static int HeadlessManifest(const char *path) {
+    char *json = LoadFile(path, NULL);
+    if (!json) {
+        fprintf(stderr, "ERROR: Failed to load manifest '%s'\n", path);
+        return 1;
+    }
+    /* mjson wants a fixed capacity; every job is an object so '{' bounds it */
+    int maxJobs = 0;
+    for (char *c = json; *c; c++)
+        if (*c == '{')
+            maxJobs++;
+    ManifestJob *jobs = calloc(maxJobs, sizeof(ManifestJob));
+    int jobCount = 0;
+    const struct json_attr_t job_attr[] = {
+        {"settings", t_string, STRUCTOBJECT(ManifestJob, settings), .len=sizeof(jobs->settings)},
+        {"biomes", t_string, STRUCTOBJECT(ManifestJob, biomes), .len=sizeof(jobs->biomes)},
+        {"script", t_string, STRUCTOBJECT(ManifestJob, script), .len=sizeof(jobs->script)},
+        {"output", t_string, STRUCTOBJECT(ManifestJob, output), .len=sizeof(jobs->output)},
+        {"x", t_integer, STRUCTOBJECT(ManifestJob, x)},
+        {"y", t_integer, STRUCTOBJECT(ManifestJob, y)},
+        {NULL}
+    };
+    const struct json_attr_t root_attr[] = {
+        {"jobs", t_array, .addr.array.element_type=t_structobject,
+                          .addr.array.arr.objects.subtype=job_attr,
+                          .addr.array.arr.objects.base=(char*)jobs,
+                          .addr.array.arr.objects.stride=sizeof(ManifestJob),
+                          .addr.array.maxlen=maxJobs,
+                          .addr.array.count=&jobCount},
+        {NULL}
+    };
+    int status = json_read_object(json, root_attr, NULL);
     free(json);
+    if (status) {
+        fprintf(stderr, "ERROR: Failed to parse manifest '%s': %s\n", path, json_error_string(status));
+        free(jobs);
+        return 1;
+    }
+    
+    Manifest manifest = {
+        .jobs = jobs,
+        .count = jobCount,
+        .base = settings
+    };
+    mtx_init(&manifest.lock, mtx_plain);
+    int workerCount = sargs_exists("manifestWorkers") ? atoi(sargs_value("manifestWorkers")) : DEFAULT_MANIFEST_WORKERS;
+    workerCount = CLAMP(workerCount, 1, MAX(jobCount, 1));
+    ManifestWorker *workers = calloc(workerCount, sizeof(ManifestWorker));
+    double start = Timestamp();
+    for (int i = 0; i < workerCount; i++) {
+        workers[i].manifest = &manifest;
+        workers[i].ctx.fbm = NewFBM();
+        thrd_create(&workers[i].thread, ManifestWorkerThread, &workers[i]);
+    }
+    for (int i = 0; i < workerCount; i++) {
+        thrd_join(workers[i].thread, NULL);
+        DestroyHeadlessContext(&workers[i].ctx);
+    }
+    printf("%d jobs (%d failed) in %.2f s\n", jobCount, manifest.failures, Timestamp() - start);
+    mtx_destroy(&manifest.lock);
+    free(workers);
+    free(jobs);
+    return manifest.failures ? 1 : 0;
+}
+
+// Generate heightmaps straight to disk, without a window or a graphics
+// context, e.g. for machines with no display:
+//   perlin headless=true [settings=a.json] [biomes=b.json] [script=c.lua]
+//          [output=out.png|out.raw|out.hmap] [<setting>=<value> ...]
+// settings may also be a .hmap, whose header records the settings it was
+// made with
+//   perlin headless=true manifest=jobs.json [settings=defaults.json]
+//          [manifestWorkers=N] [<setting>=<value> ...]
+static int Headless(void) {
+    if (sargs_exists("settings") && !LoadSettings(sargs_value("settings"), &settings))
+        return 1;
+    ParseSettingsArgs(&settings);
+    
+    if (sargs_exists("manifest"))
+        return HeadlessManifest(sargs_value("manifest"));
+    HeadlessContext ctx = {
+        .settings = settings,
+        .fbm = NewFBM()
+    };
+    int result = HeadlessRun(&ctx, sargs_value_def("biomes", ""), sargs_value_def("script", ""), sargs_value_def("output", "perlin.png"));
+    DestroyHeadlessContext(&ctx);
+    return result;
 }
 #endif
 
+static void DrawCanvas(Vec2 position, Vec2 size, Vec2 viewport) {
+    TiledTexture *texture = &state.texture;
+    int tiles = texture->columns * texture->rows;
+    for (int i = 0; i < tiles; i++) {
+        Vec2 offset = {(i % texture->columns) * TEXTURE_TILE, (i / texture->columns) * TEXTURE_TILE};
+        Vec2 tile = {MIN(TEXTURE_TILE, texture->w - offset.x), MIN(TEXTURE_TILE, texture->h - offset.y)};
+        QuadVertices(state.vertices + i * 6, position + offset, tile, viewport, state.camera2d.zoom);
+    }
+    QuadVertices(state.vertices + tiles * 6, position, size, viewport, state.camera2d.zoom);
+    sg_update_buffer(state.camera2d.binding.vertex_buffers[0], &(sg_range) {
+        .ptr = state.vertices,
+        .size = (tiles + 1) * 6 * sizeof(Vertex)
+    });
+    
+    Texture preview = {0};
+#if !WEB_BUILD
+    if (state.shown)
+        preview = state.previewTextures[state.shown-1];
+#endif
+    if (preview.id) {
+        /* Previews are stretched over the whole canvas quad, upscaling them */
+        state.camera2d.binding.fs_images[SLOT_tex] = preview;
+        sg_apply_bindings(&state.camera2d.binding);
+        sg_draw(tiles * 6, 6, 1);
+    } else {
+        for (int i = 0; i < tiles; i++) {
+            state.camera2d.binding.fs_images[SLOT_tex] = texture->tiles[i];
+            sg_apply_bindings(&state.camera2d.binding);
+            sg_draw(i * 6, 6, 1);
+        }
+    }
+}
+
+/* Coarser fallbacks go underneath, tiles that have neither are left as the
+   clear colour */
+static void DrawWorld(Vec2 position, Vec2 viewport) {
+    World *world = state.world;
+    int quads = 0;
+    for (int i = 0; i < world->fallbackCount + world->visibleCount; i++) {
+        WorldTile *tile = i < world->fallbackCount ? world->fallbacks[i] : world->visible[i - world->fallbackCount];
+        if (!tile->texture.id)
+            continue;
+        float span = (float)(WORLD_TILE << tile->level);
+        Vec2 offset = {tile->x * span, tile->y * span};
+        QuadVertices(state.vertices + quads++ * 6, position + offset, (Vec2){span, span}, viewport, state.camera2d.zoom);
+    }
+    if (!quads)
+        return;
+    sg_update_buffer(state.camera2d.binding.vertex_buffers[0], &(sg_range) {
+        .ptr = state.vertices,
+        .size = quads * 6 * sizeof(Vertex)
+    });
+    for (int i = 0, quad = 0; i < world->fallbackCount + world->visibleCount; i++) {
+        WorldTile *tile = i < world->fallbackCount ? world->fallbacks[i] : world->visible[i - world->fallbackCount];
+        if (!tile->texture.id)
+            continue;
+        state.camera2d.binding.fs_images[SLOT_tex] = tile->texture;
+        sg_apply_bindings(&state.camera2d.binding);
+        sg_draw(quad++ * 6, 6, 1);
+    }
+}
+
 void frame(void) {
     state.delta = (float)(sapp_frame_duration() * 60.0);
     
 #if !WEB_BUILD
     if (state.currentScript != 0) {
-        mtx_lock(&state.luaStateLock);
-        LuaCallPreframe(state.luaState);
-        mtx_unlock(&state.luaStateLock);
+        LuaPool *lua = AcquireLua();
+        if (lua)
+            LuaPoolCallPreframe(lua);
+        ReleaseLua(lua);
     }
 #endif
    
@@ -484,6 +1215,23 @@ void frame(void) {
     memcpy(&tmp, &settings, sizeof(Settings));
     if (nk_begin(ctx, "Settings", nk_rect(0, 0, 300, 600), NK_WINDOW_SCALABLE | NK_WINDOW_BORDER | NK_WINDOW_MINIMIZABLE)) {
         if (nk_tree_push(ctx, NK_TREE_TAB, "Size", NK_MINIMIZED)) {
+            /* Leaving the world brings back a canvas that may be stale */
+            if (nk_checkbox_label(ctx, "Infinite world", &state.worldMode) && !state.worldMode)
+                state.update = true;
+#if !WEB_BUILD
+            /* Huge maps are viewed through the world, a tile at a time */
+            if (state.world->source.header) {
+                if (nk_button_label(ctx, "Close heightmap"))
+                    SetWorldSource(state.world, NULL);
+            } else if (nk_button_label(ctx, "Open heightmap")) {
+                osdialog_filters *filters = osdialog_filters_parse("Heightmap:hmap");
+                char *filename = osdialog_file(OSDIALOG_OPEN, ".", NULL, filters);
+                if (filename && SetWorldSource(state.world, filename))
+                    state.worldMode = 1;
+                free(filename);
+                osdialog_filters_free(filters);
+            }
+#endif
             nk_property_int(ctx, "#Width:", 128, &tmp.canvasWidth, 1024, 16, 1);
             nk_property_int(ctx, "#Height:", 128, &tmp.canvasHeight, 1024, 16, 1);
             nk_tree_pop(ctx);
@@ -492,6 +1240,7 @@ void frame(void) {
             nk_property_float(ctx, "#X:", 0.f, &tmp.xoff, FLT_MAX, 1.f, 1);
             nk_property_float(ctx, "#Y:", 0.f, &tmp.yoff, FLT_MAX, 1.f, 1);
             nk_property_float(ctx, "#Z:", 0.f, &tmp.zoff, FLT_MAX, 1.f, 1);
+            nk_property_int(ctx, "#Seed:", 0, &tmp.seed, INT_MAX, 1, 1);
             nk_labelf(ctx, NK_TEXT_LEFT, "Scale: %f", settings.scale);
             nk_slider_float(ctx, .1f, &tmp.scale, 1024.f, .1f);
             nk_labelf(ctx, NK_TEXT_LEFT, "Lacunarity: %f", settings.lacunarity);
@@ -500,14 +1249,23 @@ void frame(void) {
             nk_slider_float(ctx, .1f, &tmp.gain, 5.f, .1f);
             nk_labelf(ctx, NK_TEXT_LEFT, "Octaves: %d", settings.octaves);
             nk_slider_int(ctx, 1, &tmp.octaves, 16, 1);
+            nk_checkbox_label(ctx, "Stable normalization", &tmp.normalize);
+            nk_checkbox_label(ctx, "Normal & slope maps", &tmp.surfaceMaps);
             if (nk_button_label(ctx, "Reset"))
                 resetValues = true;
 #if !WEB_BUILD
             if (nk_button_label(ctx, "Import Settings")) {
-                osdialog_filters *filters = osdialog_filters_parse("JSON:json");
+                osdialog_filters *filters = osdialog_filters_parse("JSON:json;Heightmap:hmap");
                 char *filename = osdialog_file(OSDIALOG_OPEN, ".", NULL, filters);
-                if (filename)
+                if (filename) {
+                    /* A mapped heightmap can be far bigger than a canvas */
+                    int w = tmp.canvasWidth, h = tmp.canvasHeight;
                     LoadSettings(filename, &tmp);
+                    if (MappedHeightmapFormat(filename, NULL)) {
+                        tmp.canvasWidth = w;
+                        tmp.canvasHeight = h;
+                    }
+                }
                 osdialog_filters_free(filters);
             }
             if (nk_button_label(ctx, "Export Settings")) {
@@ -515,7 +1273,7 @@ void frame(void) {
                 time_t raw = time(NULL);
                 struct tm *t = localtime(&raw);
                 strftime(path, 256, "Perlin %G-%m-%d at %H.%M.%S.json", t);
-                ExportSettings(path);
+                QueueSettingsExport(state.exports, path);
             }
 #endif
             nk_tree_pop(ctx);
@@ -551,16 +1309,19 @@ void frame(void) {
                         if (oldLength != cursor->data.bufferLength) {
                             cursor->data.buffer[cursor->data.bufferLength] = '\0';
                             cursor->data.max = CLAMP(atof(cursor->data.buffer), 0.f, 1.f);
-                            if (SortBiomes())
+                            if (SortBiomes(&state.biomes))
                                 nk_combo_close(ctx);
+                            BiomesChanged(&state.biomes);
                             state.update = true;
                         }
                         
-                        if (!Vec4Eq(lastColor, cursor->data.color) || lastMax != cursor->data.max)
+                        if (!Vec4Eq(lastColor, cursor->data.color) || lastMax != cursor->data.max) {
+                            BiomesChanged(&state.biomes);
                             state.update = true;
+                        }
                         nk_layout_row_dynamic(ctx, 25, 1);
                         if (nk_button_label(ctx, "Remove Biome")) {
-                            RemoveBiome(cursor);
+                            RemoveBiome(&state.biomes, cursor);
                             removed = true;
                             state.update = true;
                             nk_combo_close(ctx);
@@ -572,15 +1333,16 @@ void frame(void) {
                 }
                 
                 if (nk_button_label(ctx, "Add Biome")) {
-                    AddNewBiome((Vec4){0.f,0.f,0.f,255.f}, 0.f);
+                    AddNewBiome(&state.biomes, (Vec4){0.f,0.f,0.f,255.f}, 0.f);
                     state.update = true;
                 }
 #if !WEB_BUILD
                 if (nk_button_label(ctx, "Import Biomes")) {
                     osdialog_filters *filters = osdialog_filters_parse("JSON:json");
                     char *filename = osdialog_file(OSDIALOG_OPEN, ".", NULL, filters);
-                    if (filename)
-                        LoadBiomes(filename);
+                    if (filename && LoadBiomes(&state.biomes, filename))
+                        state.update = true;
+                    free(filename);
                     osdialog_filters_free(filters);
                 }
                 if (nk_button_label(ctx, "Export Biomes") && state.biomes.head) {
@@ -588,7 +1350,7 @@ void frame(void) {
                     time_t raw = time(NULL);
                     struct tm *t = localtime(&raw);
                     strftime(path, 256, "Biomes %G-%m-%d at %H.%M.%S.json", t);
-                    ExportBiomes(path);
+                    QueueBiomesExport(state.exports, &state.biomes, path);
                 }
 #endif
             }
@@ -603,16 +1365,72 @@ void frame(void) {
             currentScript = nk_combo(ctx, defaultScripts, scriptCount, currentScript, 20, nk_vec2(200, 200));
             nk_tree_pop(ctx);
         }
+        // Only affects exports, so edit settings directly rather than regenerate
+        nk_property_int(ctx, "#PNG level:", 0, &settings.pngLevel, 9, 1, 1);
+        tmp.pngLevel = settings.pngLevel;
         if (nk_button_label(ctx, "Export")) {
             char path[256];
             time_t raw = time(NULL);
             struct tm *t = localtime(&raw);
             strftime(path, 256, "Perlin %G-%m-%d at %H.%M.%S.png", t);
-            ExportBitmap(&state.bitmap, path);
+            Canvas *front = &state.canvas[state.front];
+            ExportQueueBitmap(state.exports, &front->bitmap, path, PNG_AUTO, settings.pngLevel);
+            ExportSurfaceMaps(state.exports, &front->normals, &front->slopes, path, settings.pngLevel);
+        }
+        if (nk_button_label(ctx, "Export heights (R16)")) {
+            char path[256];
+            time_t raw = time(NULL);
+            struct tm *t = localtime(&raw);
+            strftime(path, 256, "Perlin %G-%m-%d at %H.%M.%S.r16", t);
+            Canvas *front = &state.canvas[state.front];
+            ExportQueueHeightmap(state.exports, front->heightmap, front->bitmap.w, front->bitmap.h, HEIGHT_R16, path);
         }
+        // Finished exports stay listed for a few seconds
+        ExportQueuePrune(state.exports, 3.0);
+        ExportJob jobs[8];
+        int jobCount = ExportQueueSnapshot(state.exports, jobs, 8);
+        for (int i = 0; i < jobCount; i++) {
+            switch (jobs[i].status) {
+                case EXPORT_QUEUED:
+                    nk_labelf(ctx, NK_TEXT_LEFT, "Queued: %s", jobs[i].path);
+                    break;
+                case EXPORT_RUNNING: {
+                    nk_size progress = (nk_size)(jobs[i].progress * 100.f);
+                    nk_labelf(ctx, NK_TEXT_LEFT, "Writing: %s", jobs[i].path);
+                    nk_progress(ctx, &progress, 100, nk_false);
+                    break;
+                }
+                case EXPORT_DONE:
+                    nk_labelf(ctx, NK_TEXT_LEFT, "Saved: %s", jobs[i].path);
+                    break;
+                case EXPORT_FAILED:
+                    nk_labelf(ctx, NK_TEXT_LEFT, "Failed: %s", jobs[i].path);
+                    break;
+            }
+        }
+        mtx_lock(&state.generator.lock);
+        size_t cache = state.generator.cache;
+        double renderTime = state.generator.time;
+        mtx_unlock(&state.generator.lock);
+        nk_labelf(ctx, NK_TEXT_LEFT, "Render: %.1f ms", renderTime * 1000.0);
+#else
+        size_t cache = (state.fbm.gridCapacity + state.fbm.layerCapacity) * sizeof(float);
 #endif
+        nk_labelf(ctx, NK_TEXT_LEFT, "Canvas: %.1f MB (peak %.1f MB)", state.arena.used / 1048576.f, state.arena.peak / 1048576.f);
+        nk_labelf(ctx, NK_TEXT_LEFT, "World: %d tiles (%.1f MB)", state.world->count, state.world->count * WORLD_TILE_BYTES / 1048576.f);
+        nk_labelf(ctx, NK_TEXT_LEFT, "Noise cache: %.1f MB", cache / 1048576.f);
+        nk_labelf(ctx, NK_TEXT_LEFT, "Uploaded: %d/%d tiles", state.uploaded, state.texture.columns * state.texture.rows);
     }
     nk_end(ctx);
+    
+#if !WEB_BUILD
+    /* Sliders and properties are dragged with the button held over the UI */
+    bool wasEditing = state.editing;
+    if (!nk_input_is_mouse_down(&ctx->input, NK_BUTTON_LEFT))
+        state.editing = false;
+    else if (nk_input_is_mouse_pressed(&ctx->input, NK_BUTTON_LEFT) && nk_window_is_any_hovered(ctx))
+        state.editing = true;
+#endif
    
     if (!nk_window_is_any_hovered(ctx)) {
         state.camera2d.zoom = CLAMP(state.camera2d.zoom + (state.scrollY * state.delta), .1f, 10.f);
@@ -628,20 +1446,8 @@ void frame(void) {
     }
     
     if (currentScript != state.currentScript) {
-        mtx_lock(&state.luaStateLock);
-        state.update = true;
+        SwapLua(currentScript ? NewLuaPool(state.scripts[currentScript-1], 0) : NULL);
         state.currentScript = currentScript;
-        if (!currentScript) {
-            if (state.luaState) {
-                lua_close(state.luaState);
-                state.luaState = NULL;
-            }
-        } else {
-            if (state.luaState)
-                lua_close(state.luaState);
-            state.luaState = LoadLuaScript(state.scripts[state.currentScript-1]);
-        }
-        mtx_unlock(&state.luaStateLock);
     }
 #endif
     
@@ -652,14 +1458,25 @@ void frame(void) {
         state.update = true;
     }
     
-    if (tmp.canvasWidth != settings.canvasWidth || tmp.canvasHeight != settings.canvasHeight) {
+    if (tmp.canvasWidth != settings.canvasWidth || tmp.canvasHeight != settings.canvasHeight ||
+        tmp.surfaceMaps != settings.surfaceMaps) {
         settings.canvasWidth = tmp.canvasWidth;
         settings.canvasHeight = tmp.canvasHeight;
-        DestroyBitmap(&state.bitmap);
-        state.bitmap = NewBitmap(settings.canvasWidth, settings.canvasHeight);
-        DestroyTexture(state.texture);
-        state.texture = NewTexture(settings.canvasWidth, settings.canvasHeight);
-        state.camera2d.binding.fs_images[SLOT_tex] = state.texture;
+        settings.surfaceMaps = tmp.surfaceMaps;
+#if !WEB_BUILD
+        PauseGenerator(&state.generator);
+        AllocPreviews(&state.previewArena, settings.canvasWidth, settings.canvasHeight, state.previews);
+        for (int i = 0; i < MAX_PREVIEW_LEVEL; i++) {
+            DestroyTexture(state.previewTextures[i]);
+            state.previewTextures[i] = NewTexture(state.previews[i].bitmap.w, state.previews[i].bitmap.h);
+        }
+        state.shown = 0;
+#endif
+        AllocCanvases(&state.arena, settings.canvasWidth, settings.canvasHeight, settings.surfaceMaps, state.canvas, CANVAS_COUNT);
+#if !WEB_BUILD
+        ResumeGenerator(&state.generator);
+#endif
+        MakeCanvasTexture(settings.canvasWidth, settings.canvasHeight);
         state.update = true;
     }
     
@@ -671,92 +1488,63 @@ void frame(void) {
     
     if (state.update) {
         memcpy(&settings, &tmp, sizeof(Settings));
-        unsigned char *heightmap = PerlinFBM(settings.canvasWidth, settings.canvasHeight, settings.zoff, settings.xoff, settings.yoff, settings.scale, settings.lacunarity, settings.gain, settings.octaves);
+        /* The world picks settings up itself as it draws */
+        if (!state.worldMode) {
 #if !WEB_BUILD
-        if (state.currentScript != 0) {
-            mtx_lock(&state.luaStateLock);
-            LuaCallFrame(state.luaState, heightmap, settings.canvasWidth, settings.canvasHeight);
-            mtx_unlock(&state.luaStateLock);
-        }
+            GeneratorPost(&state.generator, &settings, BiomePalette(&state.biomes, state.enableBiomes), state.editing);
+#else
+            Canvas *canvas = &state.canvas[0];
+            FBMParams params = SettingsToParams(&settings);
+            GenerateCanvas(&state.fbm, &params, canvas);
+            ColorHeightmap(&state.biomes, state.enableBiomes, canvas->heightmap, &canvas->bitmap);
+            /* There's no previous copy to diff against */
+            MarkTiledTexture(&state.texture, 0, 0, canvas->bitmap.w, canvas->bitmap.h);
+            state.uploaded = UpdateTiledTexture(&state.texture, &canvas->bitmap, NULL);
 #endif
-        if (state.enableBiomes)
-            SortBiomes();
-        for (int x = 0; x < settings.canvasWidth; x++)
-            for (int y = 0; y < settings.canvasHeight; y++) {
-                int i = y * settings.canvasWidth + x;
-                unsigned char h = heightmap[i];
-                if (state.enableBiomes && state.biomes.head) {
-                    Biome *cursor = state.biomes.head;
-                    bool found = false;
-                    while (cursor) {
-                        if (h <= (unsigned char)(cursor->data.max * 255.f)) {
-                            state.bitmap.buf[i] = ColorToRGB(cursor->data.color);
-                            found = true;
-                            break;
-                        }
-                        cursor = cursor->next;
-                    }
-                    if (!found)
-                        state.bitmap.buf[i] = RGB(h, h, h);
-                } else
-                    state.bitmap.buf[i] = RGB(h, h, h);
-            }
-        
-#if !WEB_BUILD
-        if (state.currentScript != 0) {
-            mtx_lock(&state.luaStateLock);
-            LuaCallPostframe(state.luaState, &state.bitmap);
-            mtx_unlock(&state.luaStateLock);
         }
-#endif
-        
-        sg_update_image(state.texture, &(sg_image_data) {
-            .subimage[0][0] = {
-                .ptr  = state.bitmap.buf,
-                .size = state.bitmap.w * state.bitmap.h * sizeof(int)
-            }
-        });
         state.update = false;
     }
+#if !WEB_BUILD
+    if (wasEditing && !state.editing)
+        GeneratorRefine(&state.generator);
     
-    sg_begin_default_pass(&state.pass_action, sapp_width(), sapp_height());
-    sg_apply_pipeline(state.camera2d.pipeline);
+    int level = GeneratorFinished(&state.generator);
+    if (level > 0)
+        UploadPreview(level);
+    else if (!level) {
+        Canvas *back = &state.canvas[!state.front];
+        state.uploaded = UpdateTiledTexture(&state.texture, &back->bitmap, back->dirty);
+    }
+    if (level >= 0) {
+        GeneratorPresent(&state.generator);
+        state.shown = level;
+    }
+#endif
     
+    /* The canvas' top left corner before zooming, world pixel 0,0 */
     Vec2 size = {settings.canvasWidth, settings.canvasHeight};
     Vec2 viewport = {sapp_width(), sapp_height()};
     Vec2 position = state.camera2d.position + (viewport / 2.f) - (size / 2.f);
-    Vec2 quad[4] = {
-        {position.x, position.y + size.y}, // bottom left
-        position + size, // bottom right
-        {position.x + size.x, position.y }, // top right
-        position, // top left
-    };
-    Vec2 v = (Vec2){2.f,-2.f} / viewport;
-    for (int j = 0; j < 4; j++)
-        quad[j] = (v * quad[j] + (Vec2){-1.f, 1.f}) * state.camera2d.zoom;
-    
-    static const Vec2 vtexquad[4] = {
-        {0.f, 1.f}, // bottom left
-        {1.f, 1.f}, // bottom right
-        {1.f, 0.f}, // top right
-        {0.f, 0.f}, // top left
-    };
-    static const int indices[6] = {
-        0, 1, 2,
-        3, 0, 2
-    };
-    for (int i = 0; i < 6; i++)
-        state.vertices[i] = (Vertex) {
-            .position = V2TOV4(quad[indices[i]]),
-            .texcoord = vtexquad[indices[i]]
-        };
+    if (state.worldMode) {
+        /* Tiles sit at fixed noise coordinates, the offsets only slide them */
+        position -= (Vec2){settings.xoff, settings.yoff};
+        /* Zoom scales around the middle of the viewport */
+        Vec2 half = viewport / (2.f * state.camera2d.zoom);
+        Vec2 low = viewport / 2.f - half - position, high = viewport / 2.f + half - position;
+        /* Each level halves the samples, keep roughly one per screen pixel */
+        int level = CLAMP((int)floorf(log2f(1.f / state.camera2d.zoom)), 0, WORLD_MAX_LEVEL);
+        FBMParams params = SettingsToParams(&settings);
+        UpdateWorld(state.world, &params, BiomePalette(&state.biomes, state.enableBiomes), level,
+                    (int)floorf(low.x), (int)floorf(low.y), (int)ceilf(high.x), (int)ceilf(high.y), WORLD_UPLOADS_PER_FRAME);
+        ReserveQuads(state.world->fallbackCount + state.world->visibleCount);
+    }
     
-    sg_update_buffer(state.camera2d.binding.vertex_buffers[0], &(sg_range) {
-        .ptr = state.vertices,
-        .size = 6 * sizeof(Vertex)
-    });
-    sg_apply_bindings(&state.camera2d.binding);
-    sg_draw(0, 6, 1);
+    sg_begin_default_pass(&state.pass_action, sapp_width(), sapp_height());
+    sg_apply_pipeline(state.camera2d.pipeline);
+    if (state.worldMode)
+        DrawWorld(position, viewport);
+    else
+        DrawCanvas(position, size, viewport);
     
     snk_render(sapp_width(), sapp_height());
     sg_end_pass();
@@ -797,6 +1585,7 @@ void event(const sapp_event *e) {
 
 void cleanup(void) {
 #if !WEB_BUILD
+    StopGenerator(&state.generator);
     for (int i = 0; i < VectorCount(state.models); i++)
         free((void*)state.models[i]);
     DestroyVector(state.models);
@@ -804,15 +1593,29 @@ void cleanup(void) {
         free((void*)state.scripts[i]);
     DestroyVector(state.scripts);
     dmon_deinit();
+    DestroyLuaPool(state.lua);
+    mtx_destroy(&state.luaLock);
+    DestroyExportQueue(state.exports);
+    DestroyFBM(&state.previewFbm);
+    DestroyArena(&state.previewArena);
 #endif
-    DestroyBiomes();
-    DestroyBitmap(&state.bitmap);
+    DestroyBiomes(&state.biomes);
+    DestroyArena(&state.arena);
+    DestroyFBM(&state.fbm);
+    DestroyTiledTexture(&state.texture);
+    DestroyWorld(state.world);
+    DestroyDiskCache(state.disk);
+    free(state.vertices);
     snk_shutdown();
     sg_shutdown();
 }
 
 sapp_desc sokol_main(int argc, char* argv[]) {
     sargs_setup(&(sargs_desc){ .argc=argc, .argv=argv });
+#if !WEB_BUILD
+    if (sargs_boolean("headless"))
+        exit(Headless());
+#endif
 #define CHECK_ARG_INT(NAME, DEFAULT) \
     int NAME = DEFAULT; \
     if (sargs_exists(#NAME)) { \
@@ -5,7 +5,16 @@
 //  Created by George Watson on 23/02/2023.
 //
 
+/* The vector kernels must agree with the scalar reference, which clang would
+   otherwise fuse into FMAs on arm64. GCC ignores this, the Makefile passes
+   -ffp-contract=off as well */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
 #include "perlin.h"
+#include "jobs.h"
+#include "maths.h"
+#include <string.h>
 
 static const float grad3[][3] = {
     { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
@@ -13,7 +22,7 @@ static const float grad3[][3] = {
     { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 }
 };
 
-static const unsigned int perm[] = {
+static const unsigned int defaultPerm[] = {
     182, 232, 51, 15, 55, 119, 7, 107, 230, 227, 6, 34, 216, 61, 183, 36,
     40, 134, 74, 45, 157, 78, 81, 114, 145, 9, 209, 189, 147, 58, 126, 0,
     240, 169, 228, 235, 67, 198, 72, 64, 88, 98, 129, 194, 99, 71, 30, 127,
@@ -49,6 +58,98 @@ static const unsigned int perm[] = {
     79, 29, 115, 103, 142, 146, 52, 48, 89, 54, 121, 212, 122, 60, 28, 42
 };
 
+#define NOISE_CACHE_SIZE 8
+
+static unsigned int NoiseRandom(unsigned int *state) {
+    /* xorshift32, state must never be zero */
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+NoiseContext NewNoiseContext(unsigned int seed) {
+    NoiseContext result = { .seed = seed };
+    if (!seed)
+        for (int i = 0; i < 256; i++)
+            result.perm[i] = defaultPerm[i];
+    else {
+        unsigned int state = seed * 2654435761u | 1;
+        for (int i = 0; i < 256; i++)
+            result.perm[i] = i;
+        for (int i = 255; i > 0; i--) {
+            int j = NoiseRandom(&state) % (i + 1);
+            int tmp = result.perm[i];
+            result.perm[i] = result.perm[j];
+            result.perm[j] = tmp;
+        }
+    }
+    for (int i = 0; i < 256; i++) {
+        result.perm[256 + i] = result.perm[i];
+        result.gradIndex[i] = result.gradIndex[256 + i] = result.perm[i] % 12;
+    }
+    return result;
+}
+
+static NoiseContext defaultNoise;
+static struct {
+    NoiseContext noise;
+    unsigned int lastUsed;
+    bool used;
+} noiseCache[NOISE_CACHE_SIZE];
+static unsigned int noiseCacheClock = 0;
+
+#if !WEB_BUILD
+static once_flag noiseOnce = ONCE_FLAG_INIT;
+static mtx_t noiseCacheLock;
+
+static void CreateDefaultNoise(void) {
+    defaultNoise = NewNoiseContext(0);
+    mtx_init(&noiseCacheLock, mtx_plain);
+}
+#endif
+
+static const NoiseContext* DefaultNoise(void) {
+#if !WEB_BUILD
+    call_once(&noiseOnce, CreateDefaultNoise);
+#else
+    static bool created = false;
+    if (!created) {
+        defaultNoise = NewNoiseContext(0);
+        created = true;
+    }
+#endif
+    return &defaultNoise;
+}
+
+void CachedNoiseContext(unsigned int seed, NoiseContext *out) {
+    DefaultNoise();
+#if !WEB_BUILD
+    mtx_lock(&noiseCacheLock);
+#endif
+    int slot = -1, oldest = 0;
+    for (int i = 0; i < NOISE_CACHE_SIZE; i++) {
+        if (noiseCache[i].used && noiseCache[i].noise.seed == seed) {
+            slot = i;
+            break;
+        }
+        /* Unused slots have never been touched, so they are the oldest */
+        if (noiseCache[i].lastUsed < noiseCache[oldest].lastUsed)
+            oldest = i;
+    }
+    if (slot < 0) {
+        slot = oldest;
+        noiseCache[slot].noise = NewNoiseContext(seed);
+        noiseCache[slot].used = true;
+    }
+    noiseCache[slot].lastUsed = ++noiseCacheClock;
+    *out = noiseCache[slot].noise;
+#if !WEB_BUILD
+    mtx_unlock(&noiseCacheLock);
+#endif
+}
+
 static float dot3(const float a[], float x, float y, float z) {
     return a[0]*x + a[1]*y + a[2]*z;
 }
@@ -63,7 +164,8 @@ static float fade(float t) {
 
 #define FASTFLOOR(x)  (((x) >= 0) ? (int)(x) : (int)(x)-1)
 
-float Perlin(float x, float y, float z) {
+float PerlinSeeded(const NoiseContext *noise, float x, float y, float z) {
+    const int *perm = noise->perm;
     /* Find grid points */
     int gx = FASTFLOOR(x);
     int gy = FASTFLOOR(y);
@@ -82,7 +184,7 @@ float Perlin(float x, float y, float z) {
     /* Calculate gradient indices */
     unsigned int gi[8];
     for (int i = 0; i < 8; i++)
-        gi[i] = perm[gx+((i>>2)&1)+perm[gy+((i>>1)&1)+perm[gz+(i&1)]]] % 12;
+        gi[i] = noise->gradIndex[gx+((i>>2)&1)+perm[gy+((i>>1)&1)+perm[gz+(i&1)]]];
     
     /* Noise contribution from each corner */
     float n[8];
@@ -106,38 +208,773 @@ float Perlin(float x, float y, float z) {
     return lerp(nxy[0], nxy[1], w);
 }
 
+float Perlin(float x, float y, float z) {
+    return PerlinSeeded(DefaultNoise(), x, y, z);
+}
+
+/* fade'(t) = 30t^2(t - 1)^2 */
+static float fadeDeriv(float t) {
+    return 30.f * t * t * (t - 1.f) * (t - 1.f);
+}
+
+/* Interpolate a value and its gradient together; axis is the direction t
+ * moves along, whose derivative also picks up (b - a) * dt */
+static float lerpDeriv(float a, const float da[3], float b, const float db[3], float t, float dt, int axis, float out[3]) {
+    for (int k = 0; k < 3; k++)
+        out[k] = lerp(da[k], db[k], t);
+    out[axis] += (b - a) * dt;
+    return lerp(a, b, t);
+}
+
+float PerlinDeriv(const NoiseContext *noise, float x, float y, float z, float d[3]) {
+    if (!noise)
+        noise = DefaultNoise();
+    const int *perm = noise->perm;
+    int gx = FASTFLOOR(x);
+    int gy = FASTFLOOR(y);
+    int gz = FASTFLOOR(z);
+    float rx = x - gx;
+    float ry = y - gy;
+    float rz = z - gz;
+    gx = gx & 255;
+    gy = gy & 255;
+    gz = gz & 255;
+    
+    /* Corner contributions are dot products, so their gradient is the
+     * corner's gradient vector */
+    const float *g[8];
+    float n[8];
+    for (int i = 0; i < 8; i++) {
+        g[i] = grad3[noise->gradIndex[gx+((i>>2)&1)+perm[gy+((i>>1)&1)+perm[gz+(i&1)]]]];
+        n[i] = dot3(g[i], rx - ((i>>2)&1), ry - ((i>>1)&1), rz - (i&1));
+    }
+    
+    /* Same interpolation order as Perlin(), so the value is identical */
+    float u = fade(rx), du = fadeDeriv(rx);
+    float v = fade(ry), dv = fadeDeriv(ry);
+    float w = fade(rz), dw = fadeDeriv(rz);
+    float nx[4], dnx[4][3];
+    for (int i = 0; i < 4; i++)
+        nx[i] = lerpDeriv(n[i], g[i], n[4+i], g[4+i], u, du, 0, dnx[i]);
+    float nxy[2], dnxy[2][3];
+    for (int i = 0; i < 2; i++)
+        nxy[i] = lerpDeriv(nx[i], dnx[i], nx[2+i], dnx[2+i], v, dv, 1, dnxy[i]);
+    return lerpDeriv(nxy[0], dnxy[0], nxy[1], dnxy[1], w, dw, 2, d);
+}
+
+/* Batched kernels: each evaluates Perlin() for n points sharing the same z.
+ * The scalar Perlin() above stays the reference implementation; the vector
+ * paths perform the same operations in the same order, and contraction is
+ * off for this file, so that they agree with it */
+
+static void PerlinNScalar(const NoiseContext *noise, const float *x, const float *y, float z, float *out, int n) {
+    for (int i = 0; i < n; i++)
+        out[i] = PerlinSeeded(noise, x[i], y[i], z);
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define PERLIN_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PERLIN_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(PERLIN_X86) && defined(__SSE2__)
+static void PerlinNSSE2(const NoiseContext *noise, const float *x, const float *y, float z, float *out, int n) {
+    const int *perm = noise->perm;
+    int gz = FASTFLOOR(z);
+    float rz = z - gz;
+    gz &= 255;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 vrz[2] = { _mm_set1_ps(rz), _mm_set1_ps(rz - 1.f) };
+    const __m128 vw = _mm_set1_ps(fade(rz));
+    
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        
+        /* FASTFLOOR: truncate, then subtract one wherever !(x >= 0) */
+        __m128i ix = _mm_add_epi32(_mm_cvttps_epi32(vx), _mm_castps_si128(_mm_cmpnge_ps(vx, zero)));
+        __m128i iy = _mm_add_epi32(_mm_cvttps_epi32(vy), _mm_castps_si128(_mm_cmpnge_ps(vy, zero)));
+        __m128 rx = _mm_sub_ps(vx, _mm_cvtepi32_ps(ix));
+        __m128 ry = _mm_sub_ps(vy, _mm_cvtepi32_ps(iy));
+        
+        /* SSE2 has no gathers, so hash the corners lane by lane */
+        int gx[4], gy[4];
+        _mm_storeu_si128((__m128i*)gx, _mm_and_si128(ix, _mm_set1_epi32(255)));
+        _mm_storeu_si128((__m128i*)gy, _mm_and_si128(iy, _mm_set1_epi32(255)));
+        float ga[8][3][4];
+        for (int l = 0; l < 4; l++)
+            for (int c = 0; c < 8; c++) {
+                const float *g = grad3[noise->gradIndex[gx[l]+((c>>2)&1)+perm[gy[l]+((c>>1)&1)+perm[gz+(c&1)]]]];
+                ga[c][0][l] = g[0];
+                ga[c][1][l] = g[1];
+                ga[c][2][l] = g[2];
+            }
+        
+        __m128 vrx[2] = { rx, _mm_sub_ps(rx, one) };
+        __m128 vry[2] = { ry, _mm_sub_ps(ry, one) };
+        __m128 nc[8];
+        for (int c = 0; c < 8; c++)
+            nc[c] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(ga[c][0]), vrx[(c>>2)&1]),
+                                          _mm_mul_ps(_mm_loadu_ps(ga[c][1]), vry[(c>>1)&1])),
+                               _mm_mul_ps(_mm_loadu_ps(ga[c][2]), vrz[c&1]));
+        
+#define FADE4(T) _mm_mul_ps(_mm_mul_ps(_mm_mul_ps((T), (T)), (T)), \
+                            _mm_add_ps(_mm_mul_ps((T), _mm_sub_ps(_mm_mul_ps((T), _mm_set1_ps(6.f)), _mm_set1_ps(15.f))), _mm_set1_ps(10.f)))
+#define LERP4(A, B, T) _mm_add_ps(_mm_mul_ps(_mm_sub_ps(one, (T)), (A)), _mm_mul_ps((T), (B)))
+        __m128 u = FADE4(rx);
+        __m128 v = FADE4(ry);
+        __m128 nx[4];
+        for (int c = 0; c < 4; c++)
+            nx[c] = LERP4(nc[c], nc[4+c], u);
+        __m128 nxy0 = LERP4(nx[0], nx[2], v);
+        __m128 nxy1 = LERP4(nx[1], nx[3], v);
+        _mm_storeu_ps(out + i, LERP4(nxy0, nxy1, vw));
+#undef FADE4
+#undef LERP4
+    }
+    PerlinNScalar(noise, x + i, y + i, z, out + i, n - i);
+}
+#endif
+
+#if defined(PERLIN_X86) && defined(__GNUC__)
+#define PERLIN_AVX2 1
+__attribute__((target("avx2")))
+static __m256 Fade8(__m256 t) {
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t),
+                         _mm256_add_ps(_mm256_mul_ps(t, _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.f)), _mm256_set1_ps(15.f))), _mm256_set1_ps(10.f)));
+}
+
+__attribute__((target("avx2")))
+static __m256 Lerp8(__m256 a, __m256 b, __m256 t) {
+    return _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), t), a), _mm256_mul_ps(t, b));
+}
+
+/* Look up one gradient component for 8 indices in [0, 12) by shuffling
+ * within the two halves of the (padded) 16 entry table */
+__attribute__((target("avx2")))
+static __m256 Grad8(__m256 lo, __m256 hi, __m256i gi) {
+    __m256 a = _mm256_permutevar8x32_ps(lo, gi);
+    __m256 b = _mm256_permutevar8x32_ps(hi, gi);
+    __m256 m = _mm256_castsi256_ps(_mm256_cmpgt_epi32(gi, _mm256_set1_epi32(7)));
+    return _mm256_blendv_ps(a, b, m);
+}
+
+__attribute__((target("avx2")))
+static void PerlinNAVX2(const NoiseContext *noise, const float *x, const float *y, float z, float *out, int n) {
+    const int *perm = noise->perm;
+    int gz = FASTFLOOR(z);
+    float rz = z - gz;
+    gz &= 255;
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 vrz[2] = { _mm256_set1_ps(rz), _mm256_set1_ps(rz - 1.f) };
+    const __m256 vw = _mm256_set1_ps(fade(rz));
+    const __m256i mask255 = _mm256_set1_epi32(255);
+    const __m256i pz[2] = { _mm256_set1_epi32(perm[gz]), _mm256_set1_epi32(perm[gz+1]) };
+    
+    __m256 glo[3], ghi[3];
+    for (int k = 0; k < 3; k++) {
+        glo[k] = _mm256_setr_ps(grad3[0][k], grad3[1][k], grad3[2][k], grad3[3][k],
+                                grad3[4][k], grad3[5][k], grad3[6][k], grad3[7][k]);
+        ghi[k] = _mm256_setr_ps(grad3[8][k], grad3[9][k], grad3[10][k], grad3[11][k], 0, 0, 0, 0);
+    }
+    
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+        
+        __m256i ix = _mm256_add_epi32(_mm256_cvttps_epi32(vx), _mm256_castps_si256(_mm256_cmp_ps(vx, zero, _CMP_NGE_UQ)));
+        __m256i iy = _mm256_add_epi32(_mm256_cvttps_epi32(vy), _mm256_castps_si256(_mm256_cmp_ps(vy, zero, _CMP_NGE_UQ)));
+        __m256 rx = _mm256_sub_ps(vx, _mm256_cvtepi32_ps(ix));
+        __m256 ry = _mm256_sub_ps(vy, _mm256_cvtepi32_ps(iy));
+        ix = _mm256_and_si256(ix, mask255);
+        iy = _mm256_and_si256(iy, mask255);
+        
+        __m256 vrx[2] = { rx, _mm256_sub_ps(rx, one) };
+        __m256 vry[2] = { ry, _mm256_sub_ps(ry, one) };
+        __m256 nc[8];
+        for (int c = 0; c < 8; c++) {
+            __m256i a = _mm256_i32gather_epi32(perm, _mm256_add_epi32(_mm256_add_epi32(iy, _mm256_set1_epi32((c>>1)&1)), pz[c&1]), 4);
+            __m256i gi = _mm256_i32gather_epi32(noise->gradIndex, _mm256_add_epi32(_mm256_add_epi32(ix, _mm256_set1_epi32((c>>2)&1)), a), 4);
+            nc[c] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(Grad8(glo[0], ghi[0], gi), vrx[(c>>2)&1]),
+                                                _mm256_mul_ps(Grad8(glo[1], ghi[1], gi), vry[(c>>1)&1])),
+                                  _mm256_mul_ps(Grad8(glo[2], ghi[2], gi), vrz[c&1]));
+        }
+        
+        __m256 u = Fade8(rx);
+        __m256 v = Fade8(ry);
+        __m256 nx[4];
+        for (int c = 0; c < 4; c++)
+            nx[c] = Lerp8(nc[c], nc[4+c], u);
+        __m256 nxy0 = Lerp8(nx[0], nx[2], v);
+        __m256 nxy1 = Lerp8(nx[1], nx[3], v);
+        _mm256_storeu_ps(out + i, Lerp8(nxy0, nxy1, vw));
+    }
+#if defined(__SSE2__)
+    PerlinNSSE2(noise, x + i, y + i, z, out + i, n - i);
+#else
+    PerlinNScalar(noise, x + i, y + i, z, out + i, n - i);
+#endif
+}
+#endif
+
+#if defined(PERLIN_NEON)
+static void PerlinNNEON(const NoiseContext *noise, const float *x, const float *y, float z, float *out, int n) {
+    const int *perm = noise->perm;
+    int gz = FASTFLOOR(z);
+    float rz = z - gz;
+    gz &= 255;
+    const float32x4_t zero = vdupq_n_f32(0.f);
+    const float32x4_t one = vdupq_n_f32(1.f);
+    const float32x4_t vrz[2] = { vdupq_n_f32(rz), vdupq_n_f32(rz - 1.f) };
+    const float32x4_t vw = vdupq_n_f32(fade(rz));
+    
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t vx = vld1q_f32(x + i);
+        float32x4_t vy = vld1q_f32(y + i);
+        
+        int32x4_t ix = vaddq_s32(vcvtq_s32_f32(vx), vreinterpretq_s32_u32(vmvnq_u32(vcgeq_f32(vx, zero))));
+        int32x4_t iy = vaddq_s32(vcvtq_s32_f32(vy), vreinterpretq_s32_u32(vmvnq_u32(vcgeq_f32(vy, zero))));
+        float32x4_t rx = vsubq_f32(vx, vcvtq_f32_s32(ix));
+        float32x4_t ry = vsubq_f32(vy, vcvtq_f32_s32(iy));
+        
+        int gx[4], gy[4];
+        vst1q_s32(gx, vandq_s32(ix, vdupq_n_s32(255)));
+        vst1q_s32(gy, vandq_s32(iy, vdupq_n_s32(255)));
+        float ga[8][3][4];
+        for (int l = 0; l < 4; l++)
+            for (int c = 0; c < 8; c++) {
+                const float *g = grad3[noise->gradIndex[gx[l]+((c>>2)&1)+perm[gy[l]+((c>>1)&1)+perm[gz+(c&1)]]]];
+                ga[c][0][l] = g[0];
+                ga[c][1][l] = g[1];
+                ga[c][2][l] = g[2];
+            }
+        
+        float32x4_t vrx[2] = { rx, vsubq_f32(rx, one) };
+        float32x4_t vry[2] = { ry, vsubq_f32(ry, one) };
+        float32x4_t nc[8];
+        for (int c = 0; c < 8; c++)
+            nc[c] = vaddq_f32(vaddq_f32(vmulq_f32(vld1q_f32(ga[c][0]), vrx[(c>>2)&1]),
+                                        vmulq_f32(vld1q_f32(ga[c][1]), vry[(c>>1)&1])),
+                              vmulq_f32(vld1q_f32(ga[c][2]), vrz[c&1]));
+        
+#define FADE4(T) vmulq_f32(vmulq_f32(vmulq_f32((T), (T)), (T)), \
+                           vaddq_f32(vmulq_f32((T), vsubq_f32(vmulq_f32((T), vdupq_n_f32(6.f)), vdupq_n_f32(15.f))), vdupq_n_f32(10.f)))
+#define LERP4(A, B, T) vaddq_f32(vmulq_f32(vsubq_f32(one, (T)), (A)), vmulq_f32((T), (B)))
+        float32x4_t u = FADE4(rx);
+        float32x4_t v = FADE4(ry);
+        float32x4_t nx[4];
+        for (int c = 0; c < 4; c++)
+            nx[c] = LERP4(nc[c], nc[4+c], u);
+        float32x4_t nxy0 = LERP4(nx[0], nx[2], v);
+        float32x4_t nxy1 = LERP4(nx[1], nx[3], v);
+        vst1q_f32(out + i, LERP4(nxy0, nxy1, vw));
+#undef FADE4
+#undef LERP4
+    }
+    PerlinNScalar(noise, x + i, y + i, z, out + i, n - i);
+}
+#endif
+
+typedef void(*PerlinNFunc)(const NoiseContext*, const float*, const float*, float, float*, int);
+
+static PerlinNFunc PerlinNSelect(void) {
+#if defined(PERLIN_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return PerlinNAVX2;
+#endif
+#if defined(PERLIN_X86) && defined(__SSE2__)
+    return PerlinNSSE2;
+#elif defined(PERLIN_NEON)
+    return PerlinNNEON;
+#else
+    return PerlinNScalar;
+#endif
+}
+
+static PerlinNFunc perlinNImpl = NULL;
+#if !WEB_BUILD
+static once_flag perlinNOnce = ONCE_FLAG_INIT;
+#endif
+
+static void SelectPerlinN(void) {
+    perlinNImpl = PerlinNSelect();
+}
+
+void PerlinN(const NoiseContext *noise, const float *x, const float *y, float z, float *out, int n) {
+#if !WEB_BUILD
+    call_once(&perlinNOnce, SelectPerlinN);
+#else
+    if (!perlinNImpl)
+        SelectPerlinN();
+#endif
+    perlinNImpl(noise ? noise : DefaultNoise(), x, y, z, out, n);
+}
+
 static float Remap(float value, float from1, float to1, float from2, float to2) {
     return (value - from1) / (to1 - from1) * (to2 - from2) + from2;
 }
 
-unsigned char* PerlinFBM(int w, int h, float z, float xoff, float yoff, float scale, float lacunarity, float gain, int octaves) {
+/* The canvas is split into tiles small enough that a tile's grid and
+ * scratch rows stay in cache, and the tiles are farmed out to the shared pool */
+#define FBM_TILE_SIZE 64
+
+FBM NewFBM(void) {
+    return (FBM) {
+        .noise = *DefaultNoise(),
+        .grid = NULL,
+        .valid = false
+    };
+}
+
+void DestroyFBM(FBM *fbm) {
+    if (fbm->grid)
+        free(fbm->grid);
+    if (fbm->layers)
+        free(fbm->layers);
+    if (fbm->freq)
+        free(fbm->freq);
+    if (fbm->tiles)
+        free(fbm->tiles);
+    if (fbm->tileMin)
+        free(fbm->tileMin);
+    if (fbm->deriv)
+        free(fbm->deriv);
+    *fbm = NewFBM();
+}
+
+typedef struct {
+    FBM *fbm;
+    const FBMParams *params;
+    int firstLayer;
+    float *out;
+    const FBMMaps *maps;
+} FBMJob;
+
+static int FBMAddTiles(FBM *fbm, int count, int x0, int y0, int x1, int y1) {
+    int tiles = ((x1 - x0 + FBM_TILE_SIZE - 1) / FBM_TILE_SIZE) * ((y1 - y0 + FBM_TILE_SIZE - 1) / FBM_TILE_SIZE);
+    if (count + tiles > fbm->tileCapacity) {
+        fbm->tileCapacity = count + tiles;
+        fbm->tiles = realloc(fbm->tiles, fbm->tileCapacity * sizeof(FBMRect));
+        fbm->tileMin = realloc(fbm->tileMin, 2 * fbm->tileCapacity * sizeof(float));
+    }
+    for (int y = y0; y < y1; y += FBM_TILE_SIZE)
+        for (int x = x0; x < x1; x += FBM_TILE_SIZE)
+            fbm->tiles[count++] = (FBMRect) {
+                .x0 = x,
+                .y0 = y,
+                .x1 = MIN(x + FBM_TILE_SIZE, x1),
+                .y1 = MIN(y + FBM_TILE_SIZE, y1)
+            };
+    return count;
+}
+
+/* Per octave frequency and amplitude, accumulated the same way the
+ * original per-pixel loop did so every path sums identical terms. Octaves
+ * under the footprint are left out of the arrays but not out of tot */
+static void FBMPrepareOctaves(FBM *fbm, const FBMParams *p) {
+    if (p->octaves > fbm->octaveCapacity) {
+        fbm->octaveCapacity = p->octaves;
+        fbm->freq = realloc(fbm->freq, 2 * fbm->octaveCapacity * sizeof(float));
+    }
+    fbm->amp = fbm->freq + fbm->octaveCapacity;
+    float freq = 2.f,
+          amp  = 1.f,
+          tot  = 0.f;
+    fbm->octaves = 0;
+    for (int i = 0; i < p->octaves; ++i) {
+        if (p->scale / freq >= p->footprint) {
+            fbm->freq[fbm->octaves] = freq;
+            fbm->amp[fbm->octaves++] = amp;
+        }
+        tot  += amp;
+        freq *= p->lacunarity;
+        amp  *= p->gain;
+    }
+    fbm->tot = tot;
+}
+
+static void FBMFillRow(const FBMParams *p, float freq, int x0, int y, int n, float *xs, float *ys) {
+    for (int x = 0; x < n; ++x) {
+        xs[x] = ((p->xoff + (x0 + x)) / p->scale) * freq;
+        ys[x] = ((p->yoff + y) / p->scale) * freq;
+    }
+}
+
+static void FBMFinishRow(float *sum, int n, float tot, float *min, float *max) {
+    for (int x = 0; x < n; ++x) {
+        float v = sum[x] = (sum[x] / tot);
+        if (v < *min)
+            *min = v;
+        if (v > *max)
+            *max = v;
+    }
+}
+
+static void FBMTileMinMax(FBM *fbm, int tile, float min, float max) {
+    fbm->tileMin[2 * tile] = min;
+    fbm->tileMin[2 * tile + 1] = max;
+}
+
+static bool FBMCancelled(FBM *fbm) {
+    return fbm->cancel && fbm->cancel(fbm->cancelData);
+}
+
+static void FBMEvaluateTile(int tile, void *userdata) {
+    FBMJob *job = (FBMJob*)userdata;
+    FBM *fbm = job->fbm;
+    if (FBMCancelled(fbm))
+        return;
+    const FBMParams *p = job->params;
+    FBMRect r = fbm->tiles[tile];
+    int n = r.x1 - r.x0;
+    float min = FLT_MAX, max = FLT_MIN;
+    /* Scratch rows for the batched kernel: sample x, sample y, kernel output */
+    float xs[FBM_TILE_SIZE], ys[FBM_TILE_SIZE], ns[FBM_TILE_SIZE];
+    for (int y = r.y0; y < r.y1; ++y) {
+        float *sum = fbm->grid + y * p->w + r.x0;
+        for (int x = 0; x < n; ++x)
+            sum[x] = 0.f;
+        for (int i = 0; i < fbm->octaves; ++i) {
+            FBMFillRow(p, fbm->freq[i], r.x0, y, n, xs, ys);
+            PerlinN(&fbm->noise, xs, ys, p->z, ns, n);
+            for (int x = 0; x < n; ++x)
+                sum[x] += ns[x] * fbm->amp[i];
+        }
+        FBMFinishRow(sum, n, fbm->tot, &min, &max);
+    }
+    FBMTileMinMax(fbm, tile, min, max);
+}
+
+/* Evaluate any missing octave layers for the tile, then weight and sum
+ * all of them into the grid */
+static void FBMEvaluateLayersTile(int tile, void *userdata) {
+    FBMJob *job = (FBMJob*)userdata;
+    FBM *fbm = job->fbm;
+    if (FBMCancelled(fbm))
+        return;
+    const FBMParams *p = job->params;
+    FBMRect r = fbm->tiles[tile];
+    int n = r.x1 - r.x0;
+    size_t plane = (size_t)p->w * p->h;
+    float xs[FBM_TILE_SIZE], ys[FBM_TILE_SIZE];
+    for (int i = job->firstLayer; i < fbm->octaves; ++i)
+        for (int y = r.y0; y < r.y1; ++y) {
+            FBMFillRow(p, fbm->freq[i], r.x0, y, n, xs, ys);
+            PerlinN(&fbm->noise, xs, ys, p->z, fbm->layers + i * plane + y * p->w + r.x0, n);
+        }
+    
     float min = FLT_MAX, max = FLT_MIN;
-    float *grid = malloc(w * h * sizeof(float));
-    for (int x = 0; x < w; ++x)
-        for (int y = 0; y < h; ++y) {
-            float freq = 2.f,
-                  amp  = 1.f,
-                  tot  = 0.f,
-                  sum  = 0.f;
-            for (int i = 0; i < octaves; ++i) {
-                sum  += Perlin(((xoff + x) / scale) * freq, ((yoff + y) / scale) * freq, z) * amp;
-                tot  += amp;
-                freq *= lacunarity;
-                amp  *= gain;
+    for (int y = r.y0; y < r.y1; ++y) {
+        float *sum = fbm->grid + y * p->w + r.x0;
+        for (int x = 0; x < n; ++x)
+            sum[x] = 0.f;
+        for (int i = 0; i < fbm->octaves; ++i) {
+            const float *layer = fbm->layers + i * plane + y * p->w + r.x0;
+            for (int x = 0; x < n; ++x)
+                sum[x] += layer[x] * fbm->amp[i];
+        }
+        FBMFinishRow(sum, n, fbm->tot, &min, &max);
+    }
+    FBMTileMinMax(fbm, tile, min, max);
+}
+
+/* Evaluate the tile with PerlinDeriv, summing each octave's gradient,
+ * scaled by the chain rule to per-pixel units, alongside its value */
+static void FBMEvaluateDerivTile(int tile, void *userdata) {
+    FBMJob *job = (FBMJob*)userdata;
+    FBM *fbm = job->fbm;
+    if (FBMCancelled(fbm))
+        return;
+    const FBMParams *p = job->params;
+    FBMRect r = fbm->tiles[tile];
+    int n = r.x1 - r.x0;
+    float min = FLT_MAX, max = FLT_MIN;
+    float xs[FBM_TILE_SIZE], ys[FBM_TILE_SIZE];
+    for (int y = r.y0; y < r.y1; ++y) {
+        float *sum = fbm->grid + y * p->w + r.x0;
+        float *d = fbm->deriv + 2 * (y * p->w + r.x0);
+        for (int x = 0; x < n; ++x)
+            sum[x] = d[2 * x] = d[2 * x + 1] = 0.f;
+        for (int i = 0; i < fbm->octaves; ++i) {
+            FBMFillRow(p, fbm->freq[i], r.x0, y, n, xs, ys);
+            float k = fbm->amp[i] * fbm->freq[i] / p->scale;
+            for (int x = 0; x < n; ++x) {
+                float nd[3];
+                sum[x] += PerlinDeriv(&fbm->noise, xs[x], ys[x], p->z, nd) * fbm->amp[i];
+                d[2 * x] += nd[0] * k;
+                d[2 * x + 1] += nd[1] * k;
             }
-            grid[y * w + x] = sum = (sum / tot);
-            if (sum < min)
-                min = sum;
-            if (sum > max)
-                max = sum;
         }
+        FBMFinishRow(sum, n, fbm->tot, &min, &max);
+        for (int x = 0; x < 2 * n; ++x)
+            d[x] /= fbm->tot;
+    }
+    FBMTileMinMax(fbm, tile, min, max);
+}
+
+static void FBMScanTile(int tile, void *userdata) {
+    FBMJob *job = (FBMJob*)userdata;
+    FBMRect r = job->fbm->tiles[tile];
+    float min = FLT_MAX, max = FLT_MIN;
+    for (int y = r.y0; y < r.y1; y++)
+        for (int x = r.x0; x < r.x1; x++) {
+            float v = job->fbm->grid[y * job->params->w + x];
+            if (v < min)
+                min = v;
+            if (v > max)
+                max = v;
+        }
+    FBMTileMinMax(job->fbm, tile, min, max);
+}
+
+static int PackRGB(float r, float g, float b) {
+    return (int)(0xFF000000u | ((unsigned)b << 16) | ((unsigned)g << 8) | (unsigned)r);
+}
+
+/* Normals and slope/curvature from the derivative plane. Heights run from
+ * 255 at the grid's min down to 0 at its max, so the raw gradient scales
+ * by -255 / (max - min). Curvature differences the neighbouring gradients,
+ * which every tile finished writing before normalization started */
+static void FBMSurfaceTile(FBMJob *job, FBMRect r) {
+    FBM *fbm = job->fbm;
+    int w = job->params->w, h = job->params->h;
+    float k = fbm->max > fbm->min ? -255.f / (fbm->max - fbm->min) : 0.f;
+    const float *d = fbm->deriv;
+    for (int y = r.y0; y < r.y1; y++)
+        for (int x = r.x0; x < r.x1; x++) {
+            int i = y * w + x;
+            float hx = d[2 * i] * k, hy = d[2 * i + 1] * k;
+            if (job->maps->normals) {
+                /* Rows run down the image but +Y points up in tangent space */
+                float l = 1.f / sqrtf(hx * hx + hy * hy + 1.f);
+                job->maps->normals[i] = PackRGB(127.5f * (1.f - hx * l),
+                                                127.5f * (1.f + hy * l),
+                                                127.5f * (1.f + l));
+            }
+            if (job->maps->slopes) {
+                int x0 = MAX(x - 1, 0), x1 = MIN(x + 1, w - 1);
+                int y0 = MAX(y - 1, 0), y1 = MIN(y + 1, h - 1);
+                float lap = k * ((d[2 * (y * w + x1)] - d[2 * (y * w + x0)]) / MAX(x1 - x0, 1) +
+                                 (d[2 * (y1 * w + x) + 1] - d[2 * (y0 * w + x) + 1]) / MAX(y1 - y0, 1));
+                float slope = atanf(sqrtf(hx * hx + hy * hy)) / 1.5707964f;
+                job->maps->slopes[i] = PackRGB(255.f * slope,
+                                               127.5f * (1.f + lap / (1.f + fabsf(lap))),
+                                               0.f);
+            }
+        }
+}
+
+static void FBMNormalizeTile(int tile, void *userdata) {
+    FBMJob *job = (FBMJob*)userdata;
+    FBM *fbm = job->fbm;
+    FBMRect r = fbm->tiles[tile];
+    int w = job->params->w;
+    for (int y = r.y0; y < r.y1; y++)
+        for (int x = r.x0; x < r.x1; x++) {
+            float v = Remap(fbm->grid[y * w + x], fbm->min, fbm->max, 0, 1.f);
+            job->out[y * w + x] = 255.f - (255.f * CLAMP(v, 0.f, 1.f));
+        }
+    if (job->maps)
+        FBMSurfaceTile(job, r);
+}
+
+/* Move a plane's contents by (dx, dy) samples so that plane[y][x] holds
+ * what was at [y + dy][x + dx] */
+static void ShiftPlane(float *plane, int w, int h, int dx, int dy) {
+    int keep = w - abs(dx);
+    int dst = MAX(0, -dx), src = MAX(0, dx);
+    if (dy >= 0) {
+        for (int y = 0; y < h - dy; y++)
+            memmove(plane + y * w + dst, plane + (y + dy) * w + src, keep * sizeof(float));
+    } else {
+        for (int y = h - 1; y >= -dy; y--)
+            memmove(plane + y * w + dst, plane + (y + dy) * w + src, keep * sizeof(float));
+    }
+}
+
+/* Queue tiles covering the strips a (dx, dy) shift uncovers */
+static int FBMAddStrips(FBM *fbm, int w, int h, int dx, int dy) {
+    int count = 0;
+    if (dy)
+        count = FBMAddTiles(fbm, count, 0, dy > 0 ? h - dy : 0, w, dy > 0 ? h : -dy);
+    if (dx)
+        count = FBMAddTiles(fbm, count,
+                            dx > 0 ? w - dx : 0, dy < 0 ? -dy : 0,
+                            dx > 0 ? w : -dx, dy > 0 ? h - dy : h);
+    return count;
+}
+
+static bool FBMCanShift(FBM *fbm, const FBMParams *p, int *dx, int *dy) {
+    const FBMParams *o = &fbm->params;
+    if (!fbm->valid || o->seed != p->seed || o->derivatives != p->derivatives ||
+        o->w != p->w || o->h != p->h || o->z != p->z ||
+        o->scale != p->scale || o->lacunarity != p->lacunarity ||
+        o->gain != p->gain || o->octaves != p->octaves || o->footprint != p->footprint)
+        return false;
+    float fx = p->xoff - o->xoff;
+    float fy = p->yoff - o->yoff;
+    if (fbm->snapPans) {
+        fx = roundf(fx);
+        fy = roundf(fy);
+    } else if (fx != floorf(fx) || fy != floorf(fy))
+        return false;
+    if (fabsf(fx) >= p->w || fabsf(fy) >= p->h)
+        return false;
+    *dx = (int)fx;
+    *dy = (int)fy;
+    return true;
+}
+
+/* Cached layers only depend on where the samples are, not on gain or on
+ * how many octaves are summed */
+static bool FBMLayersMatch(FBM *fbm, const FBMParams *p) {
+    const FBMParams *o = &fbm->params;
+    return fbm->valid && fbm->layerCount && o->seed == p->seed &&
+           o->w == p->w && o->h == p->h && o->z == p->z &&
+           o->xoff == p->xoff && o->yoff == p->yoff &&
+           o->scale == p->scale && o->lacunarity == p->lacunarity &&
+           o->footprint == p->footprint;
+}
+
+bool FBMGenerate(FBM *fbm, const FBMParams *params, float *out) {
+    return FBMGenerateMaps(fbm, params, out, NULL);
+}
+
+bool FBMGenerateMaps(FBM *fbm, const FBMParams *params, float *out, const FBMMaps *maps) {
+    FBMParams withDeriv;
+    if (maps && !params->derivatives) {
+        withDeriv = *params;
+        withDeriv.derivatives = true;
+        params = &withDeriv;
+    }
+    FBMJob job = {
+        .fbm = fbm,
+        .params = params,
+        .firstLayer = 0,
+        .out = out,
+        .maps = maps
+    };
+    JobPool *pool = SharedJobPool();
+    FBMPrepareOctaves(fbm, params);
+    /* Each FBM keeps its own copy, so LRU evictions never pull a table
+     * out from under a generation in flight */
+    if (fbm->noise.seed != params->seed)
+        CachedNoiseContext(params->seed, &fbm->noise);
     
-    unsigned char *result = malloc(w * h * sizeof(unsigned char));
-    for (int x = 0; x < w; x++)
-        for (int y = 0; y < h; y++) {
-            float height = 255.f - (255.f * Remap(grid[y * w + x], min, max, 0, 1.f));
-            result[y * w + x] = (unsigned char)height;
+    size_t plane = (size_t)params->w * params->h;
+    if (plane > fbm->gridCapacity) {
+        fbm->grid = realloc(fbm->grid, plane * sizeof(float));
+        fbm->gridCapacity = plane;
+    }
+    
+    int dx = 0, dy = 0, count;
+    bool incremental = false;
+    JobFunc evaluate = FBMEvaluateTile;
+    size_t layersSize = plane * fbm->octaves;
+    if (params->derivatives) {
+        /* Derivatives aren't kept per octave, so skip the layer cache but
+         * still shift the interleaved (d/dx, d/dy) plane on pans */
+        evaluate = FBMEvaluateDerivTile;
+        if (2 * plane > fbm->derivCapacity) {
+            fbm->deriv = realloc(fbm->deriv, 2 * plane * sizeof(float));
+            fbm->derivCapacity = 2 * plane;
+        }
+        fbm->layerCount = 0;
+        if ((incremental = FBMCanShift(fbm, params, &dx, &dy))) {
+            ShiftPlane(fbm->grid, params->w, params->h, dx, dy);
+            ShiftPlane(fbm->deriv, 2 * params->w, params->h, 2 * dx, dy);
+        }
+    } else if (fbm->layerBudget && layersSize * sizeof(float) <= fbm->layerBudget) {
+        evaluate = FBMEvaluateLayersTile;
+        if (layersSize > fbm->layerCapacity) {
+            fbm->layers = realloc(fbm->layers, layersSize * sizeof(float));
+            fbm->layerCapacity = layersSize;
         }
-    free(grid);
+        if (FBMLayersMatch(fbm, params)) {
+            job.firstLayer = MIN(fbm->layerCount, fbm->octaves);
+            fbm->layerCount = MAX(fbm->layerCount, fbm->octaves);
+        } else {
+            if (fbm->layerCount >= fbm->octaves && (incremental = FBMCanShift(fbm, params, &dx, &dy))) {
+                ShiftPlane(fbm->grid, params->w, params->h, dx, dy);
+                for (int i = 0; i < fbm->octaves; i++)
+                    ShiftPlane(fbm->layers + i * plane, params->w, params->h, dx, dy);
+            }
+            fbm->layerCount = fbm->octaves;
+        }
+    } else {
+        fbm->layerCount = 0;
+        if ((incremental = FBMCanShift(fbm, params, &dx, &dy)))
+            ShiftPlane(fbm->grid, params->w, params->h, dx, dy);
+    }
+    
+    /* A snapped pan carries on from the offsets the grid was made with */
+    FBMParams snapped;
+    if (incremental && (params->xoff != fbm->params.xoff + dx || params->yoff != fbm->params.yoff + dy)) {
+        snapped = *params;
+        snapped.xoff = fbm->params.xoff + dx;
+        snapped.yoff = fbm->params.yoff + dy;
+        job.params = params = &snapped;
+    }
+    if (incremental)
+        count = FBMAddStrips(fbm, params->w, params->h, dx, dy);
+    else
+        count = FBMAddTiles(fbm, 0, 0, 0, params->w, params->h);
+    JobPoolRun(pool, evaluate, &job, count);
+    /* Skipped tiles leave holes in the grid and layers, so start over */
+    if (FBMCancelled(fbm)) {
+        fbm->valid = false;
+        fbm->layerCount = 0;
+        return false;
+    }
+    fbm->params = *params;
+    fbm->valid = true;
+    
+    if (incremental)
+        count = FBMAddTiles(fbm, 0, 0, 0, params->w, params->h);
+    if (params->normalize == NORMALIZE_GLOBAL) {
+        fbm->min = -1.f;
+        fbm->max = 1.f;
+    } else {
+        /* Shifted samples keep their value but may have held the old extremes */
+        if (incremental)
+            JobPoolRun(pool, FBMScanTile, &job, count);
+        fbm->min = FLT_MAX;
+        fbm->max = FLT_MIN;
+        for (int i = 0; i < count; i++) {
+            if (fbm->tileMin[2 * i] < fbm->min)
+                fbm->min = fbm->tileMin[2 * i];
+            if (fbm->tileMin[2 * i + 1] > fbm->max)
+                fbm->max = fbm->tileMin[2 * i + 1];
+        }
+    }
+    JobPoolRun(pool, FBMNormalizeTile, &job, count);
+    return true;
+}
+
+unsigned char* PerlinFBM(int w, int h, float z, float xoff, float yoff, float scale, float lacunarity, float gain, int octaves) {
+    FBM fbm = NewFBM();
+    FBMParams params = {
+        .w = w, .h = h,
+        .z = z, .xoff = xoff, .yoff = yoff,
+        .scale = scale, .lacunarity = lacunarity, .gain = gain,
+        .octaves = octaves,
+        .normalize = NORMALIZE_LOCAL
+    };
+    float *heights = malloc(w * h * sizeof(float));
+    FBMGenerate(&fbm, &params, heights);
+    unsigned char *result = malloc(w * h * sizeof(unsigned char));
+    for (int i = 0; i < w * h; i++)
+        result[i] = (unsigned char)heights[i];
+    free(heights);
+    DestroyFBM(&fbm);
     return result;
 }
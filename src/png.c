@@ -0,0 +1,587 @@
+//
+//  png.c
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#include "png.h"
+#if !WEB_BUILD
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+/* Input is buffered in front of the window and slid back by WINDOW_SIZE,
+ * so hash chains indexed by pos & WINDOW_MASK survive the slide */
+#define BUFFER_SIZE (3 * WINDOW_SIZE)
+#define HASH_SIZE (1 << 15)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_STORED 65535
+#define SYMBOL_LIMIT 16384
+#define IDAT_SIZE 65536
+#define NIL -1
+
+typedef struct {
+    unsigned short len, dist; // dist 0 means len is a literal byte
+    unsigned char lenCode, distCode;
+} PngSymbol;
+
+struct PngDeflate {
+    int maxChain, niceLength;
+    bool lazy;
+    unsigned char window[BUFFER_SIZE];
+    int fill, cursor, inserted;
+    int head[HASH_SIZE], prev[WINDOW_SIZE];
+    PngSymbol symbols[SYMBOL_LIMIT];
+    int symbolCount;
+    unsigned litFreq[286], distFreq[30];
+    unsigned adlerA, adlerB;
+    unsigned long long bits;
+    int bitCount;
+    unsigned char out[IDAT_SIZE];
+    int outCount;
+};
+
+static const struct {
+    int maxChain, niceLength;
+    bool lazy;
+} levels[10] = {
+    {0, 0, false}, {4, 8, false}, {8, 16, false}, {16, 32, false}, {16, 32, true},
+    {32, 64, true}, {128, 128, true}, {256, 258, true}, {1024, 258, true}, {4096, 258, true}
+};
+
+static const unsigned short lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/* The order code length code lengths are sent in */
+static const unsigned char codeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Nibble-at-a-time CRC32, a constant table so concurrent exports are safe */
+static unsigned Crc32(unsigned crc, const unsigned char *data, size_t n) {
+    static const unsigned t[16] = {
+        0, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+    for (size_t i = 0; i < n; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ t[crc & 15];
+        crc = (crc >> 4) ^ t[crc & 15];
+    }
+    return crc;
+}
+
+static void PutU32(unsigned char *p, unsigned v) {
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static void WriteChunk(PngWriter *png, const char *type, const unsigned char *data, unsigned len) {
+    unsigned char header[8], footer[4];
+    PutU32(header, len);
+    memcpy(header + 4, type, 4);
+    PutU32(footer, ~Crc32(Crc32(~0u, header + 4, 4), data, len));
+    if (fwrite(header, 1, 8, png->fp) != 8 ||
+        (len && fwrite(data, 1, len, png->fp) != len) ||
+        fwrite(footer, 1, 4, png->fp) != 4)
+        png->failed = true;
+}
+
+static void FlushIdat(PngWriter *png) {
+    if (png->z->outCount)
+        WriteChunk(png, "IDAT", png->z->out, png->z->outCount);
+    png->z->outCount = 0;
+}
+
+static void PutByte(PngWriter *png, unsigned char b) {
+    struct PngDeflate *z = png->z;
+    z->out[z->outCount++] = b;
+    if (z->outCount == IDAT_SIZE)
+        FlushIdat(png);
+}
+
+/* Deflate packs bits LSB first */
+static void PutBits(PngWriter *png, unsigned value, int count) {
+    struct PngDeflate *z = png->z;
+    z->bits |= (unsigned long long)value << z->bitCount;
+    z->bitCount += count;
+    while (z->bitCount >= 8) {
+        PutByte(png, z->bits & 0xFF);
+        z->bits >>= 8;
+        z->bitCount -= 8;
+    }
+}
+
+static void AlignBits(PngWriter *png) {
+    if (png->z->bitCount)
+        PutBits(png, 0, 8 - png->z->bitCount);
+}
+
+typedef struct {
+    unsigned freq;
+    int sym;
+} HuffLeaf;
+
+static int CompareLeaves(const void *a, const void *b) {
+    const HuffLeaf *x = a, *y = b;
+    if (x->freq != y->freq)
+        return x->freq < y->freq ? -1 : 1;
+    return x->sym - y->sym;
+}
+
+/* Huffman code lengths capped at limit bits. Leaves are sorted by frequency
+ * so a two-queue merge builds the tree, then over-long codes are folded back
+ * into the limit while keeping the Kraft sum exact */
+static void BuildLengths(const unsigned *freq, int n, int limit, unsigned char *lengths) {
+    HuffLeaf leaves[288];
+    unsigned weight[576];
+    int parent[576], depth[576], count = 0;
+    memset(lengths, 0, n);
+    for (int i = 0; i < n; i++)
+        if (freq[i])
+            leaves[count++] = (HuffLeaf) { freq[i], i };
+    if (!count)
+        return;
+    /* Pad a lone symbol with a second so the code is complete, which
+     * inflaters insist on for the code length alphabet */
+    if (count == 1) {
+        lengths[leaves[0].sym] = 1;
+        lengths[leaves[0].sym ? 0 : 1] = 1;
+        return;
+    }
+    qsort(leaves, count, sizeof(HuffLeaf), CompareLeaves);
+    for (int i = 0; i < count; i++)
+        weight[i] = leaves[i].freq;
+    int leaf = 0, node = count, next = count;
+    for (int made = 0; made < count - 1; made++, next++) {
+        int pick[2];
+        for (int k = 0; k < 2; k++)
+            pick[k] = leaf < count && (node >= next || weight[leaf] <= weight[node]) ? leaf++ : node++;
+        weight[next] = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = parent[pick[1]] = next;
+    }
+    /* Parents are always created after their children */
+    int lengthCount[33] = {0};
+    depth[next - 1] = 0;
+    for (int i = next - 2; i >= 0; i--)
+        depth[i] = depth[parent[i]] + 1;
+    for (int i = 0; i < count; i++)
+        lengthCount[depth[i] > 32 ? 32 : depth[i]]++;
+    for (int i = limit + 1; i <= 32; i++) {
+        lengthCount[limit] += lengthCount[i];
+        lengthCount[i] = 0;
+    }
+    unsigned total = 0;
+    for (int i = limit; i > 0; i--)
+        total += (unsigned)lengthCount[i] << (limit - i);
+    while (total != 1u << limit) {
+        lengthCount[limit]--;
+        for (int i = limit - 1; i > 0; i--)
+            if (lengthCount[i]) {
+                lengthCount[i]--;
+                lengthCount[i + 1] += 2;
+                break;
+            }
+        total--;
+    }
+    /* Rarest symbols take the longest codes */
+    for (int len = limit, j = 0; len > 0; len--)
+        for (int k = lengthCount[len]; k > 0; k--)
+            lengths[leaves[j++].sym] = len;
+}
+
+/* Canonical codes, bit-reversed so PutBits can send them LSB first */
+static void BuildCodes(const unsigned char *lengths, int n, unsigned short *codes) {
+    int count[16] = {0}, next[16];
+    for (int i = 0; i < n; i++)
+        count[lengths[i]]++;
+    count[0] = 0;
+    for (int bits = 1, code = 0; bits < 16; bits++) {
+        code = (code + count[bits - 1]) << 1;
+        next[bits] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!lengths[i])
+            continue;
+        unsigned code = next[lengths[i]]++, reversed = 0;
+        for (int b = 0; b < lengths[i]; b++, code >>= 1)
+            reversed = (reversed << 1) | (code & 1);
+        codes[i] = reversed;
+    }
+}
+
+static void WriteBlock(PngWriter *png, bool last) {
+    struct PngDeflate *z = png->z;
+    unsigned char lengths[286 + 30], *litLengths = lengths, distLengths[30];
+    unsigned short litCodes[286], distCodes[30];
+    z->litFreq[256] = 1;
+    /* A block with no matches still has to describe one distance code */
+    bool anyDist = false;
+    for (int i = 0; i < 30; i++)
+        anyDist |= z->distFreq[i] != 0;
+    if (!anyDist)
+        z->distFreq[0] = 1;
+    BuildLengths(z->litFreq, 286, 15, litLengths);
+    BuildLengths(z->distFreq, 30, 15, distLengths);
+    BuildCodes(litLengths, 286, litCodes);
+    BuildCodes(distLengths, 30, distCodes);
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && !litLengths[hlit - 1])
+        hlit--;
+    while (hdist > 1 && !distLengths[hdist - 1])
+        hdist--;
+    memmove(lengths + hlit, distLengths, hdist);
+
+    /* Run-length encode both length tables with codes 16 (repeat previous),
+     * 17 and 18 (runs of zeros) */
+    unsigned char clSyms[286 + 30], clExtra[286 + 30];
+    unsigned clFreq[19] = {0};
+    int clCount = 0, total = hlit + hdist;
+    for (int i = 0; i < total;) {
+        int len = lengths[i], run = 1;
+        while (i + run < total && lengths[i + run] == len)
+            run++;
+        i += run;
+        if (!len) {
+            while (run >= 11) {
+                int r = run > 138 ? 138 : run;
+                clSyms[clCount] = 18;
+                clExtra[clCount++] = r - 11;
+                run -= r;
+            }
+            if (run >= 3) {
+                clSyms[clCount] = 17;
+                clExtra[clCount++] = run - 3;
+                run = 0;
+            }
+        } else {
+            clSyms[clCount] = len;
+            clExtra[clCount++] = 0;
+            run--;
+            while (run >= 3) {
+                int r = run > 6 ? 6 : run;
+                clSyms[clCount] = 16;
+                clExtra[clCount++] = r - 3;
+                run -= r;
+            }
+        }
+        for (; run > 0; run--) {
+            clSyms[clCount] = len;
+            clExtra[clCount++] = 0;
+        }
+    }
+    for (int i = 0; i < clCount; i++)
+        clFreq[clSyms[i]]++;
+    unsigned char clLengths[19];
+    unsigned short clCodes[19];
+    BuildLengths(clFreq, 19, 7, clLengths);
+    BuildCodes(clLengths, 19, clCodes);
+    int hclen = 19;
+    while (hclen > 4 && !clLengths[codeLengthOrder[hclen - 1]])
+        hclen--;
+
+    PutBits(png, last, 1);
+    PutBits(png, 2, 2);
+    PutBits(png, hlit - 257, 5);
+    PutBits(png, hdist - 1, 5);
+    PutBits(png, hclen - 4, 4);
+    for (int i = 0; i < hclen; i++)
+        PutBits(png, clLengths[codeLengthOrder[i]], 3);
+    for (int i = 0; i < clCount; i++) {
+        int s = clSyms[i];
+        PutBits(png, clCodes[s], clLengths[s]);
+        if (s >= 16)
+            PutBits(png, clExtra[i], s == 16 ? 2 : s == 17 ? 3 : 7);
+    }
+    for (int i = 0; i < z->symbolCount; i++) {
+        PngSymbol *s = &z->symbols[i];
+        if (!s->dist) {
+            PutBits(png, litCodes[s->len], litLengths[s->len]);
+            continue;
+        }
+        int lc = 257 + s->lenCode;
+        PutBits(png, litCodes[lc], litLengths[lc]);
+        PutBits(png, s->len - lengthBase[s->lenCode], lengthExtra[s->lenCode]);
+        PutBits(png, distCodes[s->distCode], distLengths[s->distCode]);
+        PutBits(png, s->dist - distBase[s->distCode], distExtra[s->distCode]);
+    }
+    PutBits(png, litCodes[256], litLengths[256]);
+
+    z->symbolCount = 0;
+    memset(z->litFreq, 0, sizeof(z->litFreq));
+    memset(z->distFreq, 0, sizeof(z->distFreq));
+}
+
+static void WriteStored(PngWriter *png, const unsigned char *data, int len, bool last) {
+    PutBits(png, last, 1);
+    PutBits(png, 0, 2);
+    AlignBits(png);
+    PutBits(png, len, 16);
+    PutBits(png, len ^ 0xFFFF, 16);
+    for (int i = 0; i < len; i++)
+        PutByte(png, data[i]);
+}
+
+static void EmitSymbol(PngWriter *png, int len, int dist) {
+    struct PngDeflate *z = png->z;
+    PngSymbol s = { .len = len, .dist = dist };
+    if (dist) {
+        while (s.lenCode < 28 && lengthBase[s.lenCode + 1] <= len)
+            s.lenCode++;
+        while (s.distCode < 29 && distBase[s.distCode + 1] <= dist)
+            s.distCode++;
+        z->litFreq[257 + s.lenCode]++;
+        z->distFreq[s.distCode]++;
+    } else
+        z->litFreq[len]++;
+    z->symbols[z->symbolCount++] = s;
+    if (z->symbolCount == SYMBOL_LIMIT)
+        WriteBlock(png, false);
+}
+
+static unsigned Hash(const unsigned char *p) {
+    return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+/* Chain every position before pos that has three bytes to hash */
+static void InsertUpTo(struct PngDeflate *z, int pos) {
+    for (; z->inserted < pos && z->inserted + MIN_MATCH <= z->fill; z->inserted++) {
+        unsigned h = Hash(z->window + z->inserted);
+        z->prev[z->inserted & WINDOW_MASK] = z->head[h];
+        z->head[h] = z->inserted;
+    }
+}
+
+static int LongestMatch(struct PngDeflate *z, int pos, int limit, int *dist) {
+    if (limit < MIN_MATCH)
+        return 0;
+    const unsigned char *b = z->window + pos;
+    int best = 0, chain = z->maxChain;
+    for (int cand = z->head[Hash(b)]; cand != NIL && cand > pos - WINDOW_SIZE && chain-- > 0; cand = z->prev[cand & WINDOW_MASK]) {
+        const unsigned char *a = z->window + cand;
+        if (a[best] != b[best] || a[0] != b[0] || a[1] != b[1])
+            continue;
+        int len = 2;
+        while (len < limit && a[len] == b[len])
+            len++;
+        if (len > best) {
+            best = len;
+            *dist = pos - cand;
+            if (len >= z->niceLength || len == limit)
+                break;
+        }
+    }
+    return best >= MIN_MATCH ? best : 0;
+}
+
+/* LZ77 over the buffered input. Until flushing, stop MAX_MATCH short of the
+ * end so every match can see its full length */
+static void Compress(PngWriter *png, bool flush) {
+    struct PngDeflate *z = png->z;
+    int end = flush ? z->fill : z->fill - MAX_MATCH;
+    while (z->cursor < end) {
+        int pos = z->cursor, avail = z->fill - pos, dist = 0;
+        InsertUpTo(z, pos);
+        int len = LongestMatch(z, pos, avail < MAX_MATCH ? avail : MAX_MATCH, &dist);
+        if (len && z->lazy && len < z->niceLength) {
+            int nextDist;
+            InsertUpTo(z, pos + 1);
+            if (LongestMatch(z, pos + 1, avail - 1 < MAX_MATCH ? avail - 1 : MAX_MATCH, &nextDist) > len)
+                len = 0;
+        }
+        if (len) {
+            EmitSymbol(png, len, dist);
+            z->cursor += len;
+        } else {
+            EmitSymbol(png, z->window[pos], 0);
+            z->cursor++;
+        }
+    }
+}
+
+static void Slide(struct PngDeflate *z) {
+    memmove(z->window, z->window + WINDOW_SIZE, z->fill - WINDOW_SIZE);
+    z->fill -= WINDOW_SIZE;
+    z->cursor -= WINDOW_SIZE;
+    z->inserted -= WINDOW_SIZE;
+    for (int i = 0; i < HASH_SIZE; i++)
+        z->head[i] = z->head[i] >= WINDOW_SIZE ? z->head[i] - WINDOW_SIZE : NIL;
+    for (int i = 0; i < WINDOW_SIZE; i++)
+        z->prev[i] = z->prev[i] >= WINDOW_SIZE ? z->prev[i] - WINDOW_SIZE : NIL;
+}
+
+static void DeflateWrite(PngWriter *png, const unsigned char *data, int n) {
+    struct PngDeflate *z = png->z;
+    /* 5552 bytes is the most that can be summed before the modulo overflows */
+    for (int i = 0; i < n;) {
+        int end = n - i > 5552 ? i + 5552 : n;
+        for (; i < end; i++) {
+            z->adlerA += data[i];
+            z->adlerB += z->adlerA;
+        }
+        z->adlerA %= 65521;
+        z->adlerB %= 65521;
+    }
+    while (n > 0) {
+        if (z->fill == BUFFER_SIZE) {
+            if (png->level) {
+                Slide(z);
+            } else {
+                for (int i = 0; i < z->fill; i += MAX_STORED)
+                    WriteStored(png, z->window + i, z->fill - i < MAX_STORED ? z->fill - i : MAX_STORED, false);
+                z->fill = 0;
+            }
+        }
+        int take = BUFFER_SIZE - z->fill < n ? BUFFER_SIZE - z->fill : n;
+        memcpy(z->window + z->fill, data, take);
+        z->fill += take;
+        data += take;
+        n -= take;
+        if (png->level)
+            Compress(png, false);
+    }
+}
+
+static void DeflateFinish(PngWriter *png) {
+    struct PngDeflate *z = png->z;
+    if (png->level) {
+        Compress(png, true);
+        WriteBlock(png, true);
+    } else {
+        int i = 0;
+        for (; z->fill - i > MAX_STORED; i += MAX_STORED)
+            WriteStored(png, z->window + i, MAX_STORED, false);
+        WriteStored(png, z->window + i, z->fill - i, true);
+    }
+    AlignBits(png);
+    unsigned adler = (z->adlerB << 16) | z->adlerA;
+    for (int shift = 24; shift >= 0; shift -= 8)
+        PutByte(png, (adler >> shift) & 0xFF);
+    FlushIdat(png);
+}
+
+static int PngBytesPerPixel(PngFormat format) {
+    switch (format) {
+        case PNG_GRAY8:
+            return 1;
+        case PNG_GRAY16:
+            return 2;
+        case PNG_RGB8:
+            return 3;
+        case PNG_RGBA8:
+        default:
+            return 4;
+    }
+}
+
+PngWriter* NewPngWriter(const char *path, int w, int h, PngFormat format, int level) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return NULL;
+    PngWriter *png = calloc(1, sizeof(PngWriter));
+    png->fp = fp;
+    png->w = w;
+    png->h = h;
+    png->format = format;
+    png->bpp = PngBytesPerPixel(format);
+    png->level = level < 0 ? 0 : level > 9 ? 9 : level;
+    png->prev = calloc(w * png->bpp, 1);
+    png->filtered = malloc(2 * (w * png->bpp + 1));
+    png->z = calloc(1, sizeof(struct PngDeflate));
+    png->z->maxChain = levels[png->level].maxChain;
+    png->z->niceLength = levels[png->level].niceLength;
+    png->z->lazy = levels[png->level].lazy;
+    png->z->adlerA = 1;
+    for (int i = 0; i < HASH_SIZE; i++)
+        png->z->head[i] = NIL;
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    static const unsigned char colorTypes[] = { 0, 0, 0, 2, 6 };
+    unsigned char ihdr[13] = {0};
+    PutU32(ihdr, w);
+    PutU32(ihdr + 4, h);
+    ihdr[8] = format == PNG_GRAY16 ? 16 : 8;
+    ihdr[9] = colorTypes[format];
+    if (fwrite(signature, 1, 8, fp) != 8)
+        png->failed = true;
+    WriteChunk(png, "IHDR", ihdr, 13);
+    /* zlib header, FLG only advertises the level */
+    PutByte(png, 0x78);
+    PutByte(png, png->level < 2 ? 0x01 : png->level < 6 ? 0x5E : png->level == 6 ? 0x9C : 0xDA);
+    return png;
+}
+
+static int Paeth(int a, int b, int c) {
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+/* Filter into out (type byte first), returning the sum of the bytes taken
+ * as signed, the usual heuristic for which filter compresses best */
+static unsigned FilterRow(const unsigned char *row, const unsigned char *prev, int n, int bpp, int type, unsigned char *out) {
+    unsigned cost = 0;
+    out[0] = type;
+    for (int i = 0; i < n; i++) {
+        int a = i >= bpp ? row[i - bpp] : 0, b = prev[i], c = i >= bpp ? prev[i - bpp] : 0;
+        int predict = type == 1 ? a : type == 2 ? b : type == 3 ? (a + b) / 2 : type == 4 ? Paeth(a, b, c) : 0;
+        unsigned char v = (unsigned char)(row[i] - predict);
+        out[i + 1] = v;
+        cost += v < 128 ? v : 256 - v;
+    }
+    return cost;
+}
+
+void PngWriteRow(PngWriter *png, const unsigned char *row) {
+    if (png->rows >= png->h) {
+        png->failed = true;
+        return;
+    }
+    int n = png->w * png->bpp;
+    unsigned char *best = png->filtered, *scratch = png->filtered + n + 1;
+    unsigned bestCost = FilterRow(row, png->prev, n, png->bpp, 0, best);
+    /* Stored output gains nothing from filtering */
+    for (int type = 1; type < 5 && png->level; type++) {
+        unsigned cost = FilterRow(row, png->prev, n, png->bpp, type, scratch);
+        if (cost < bestCost) {
+            unsigned char *swap = best;
+            best = scratch;
+            scratch = swap;
+            bestCost = cost;
+        }
+    }
+    DeflateWrite(png, best, n + 1);
+    memcpy(png->prev, row, n);
+    png->rows++;
+}
+
+bool FinishPngWriter(PngWriter *png) {
+    DeflateFinish(png);
+    WriteChunk(png, "IEND", NULL, 0);
+    bool result = !png->failed && png->rows == png->h;
+    if (fclose(png->fp))
+        result = false;
+    free(png->prev);
+    free(png->filtered);
+    free(png->z);
+    free(png);
+    return result;
+}
+#endif
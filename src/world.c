@@ -0,0 +1,366 @@
+//
+//  world.c
+//  sokol
+//
+//  Created by George Watson on 23/02/2023.
+//
+
+#include "world.h"
+#include "maths.h"
+#include <string.h>
+#include <math.h>
+
+#define WORLD_BUCKETS 4096
+// Octaves with lattice points closer than this many samples are skipped
+#define WORLD_FOOTPRINT 1.f
+
+#if !WEB_BUILD
+#define WorldLock(W) mtx_lock(&(W)->lock)
+#define WorldUnlock(W) mtx_unlock(&(W)->lock)
+#else
+#define WorldLock(W)
+#define WorldUnlock(W)
+#endif
+
+/* Every parameter that changes the noise, bar the offsets which only slide
+   the tiles, so scrolling keeps hitting the same tiles */
+static uint64_t WorldKey(const FBMParams *p) {
+    float floats[] = { p->z, p->scale, p->lacunarity, p->gain };
+    unsigned int ints[] = { (unsigned int)p->octaves, p->seed };
+    return CacheHash(CacheHash(CACHE_HASH_INIT, floats, sizeof(floats)), ints, sizeof(ints));
+}
+
+/* Names a tile in the disk cache, the settings key plus where it sits */
+static uint64_t WorldDiskKey(const WorldTile *tile) {
+    int where[] = { tile->x, tile->y, tile->level, WORLD_TILE };
+    return CacheHash(CacheHash(tile->key, "world", 5), where, sizeof(where));
+}
+
+static unsigned int WorldBucket(int x, int y, int level, uint64_t key) {
+    uint64_t hash = key ^ ((uint64_t)(unsigned int)x * 0x9E3779B97F4A7C15ull) ^
+                    ((uint64_t)(unsigned int)y * 0xC2B2AE3D27D4EB4Full) ^ ((uint64_t)level << 59);
+    return (unsigned int)(hash ^ (hash >> 29)) & (WORLD_BUCKETS - 1);
+}
+
+/* Most recently seen tiles are kept at the head */
+static void WorldUnlink(World *world, WorldTile *tile) {
+    if (tile->prev)
+        tile->prev->next = tile->next;
+    else
+        world->head = tile->next;
+    if (tile->next)
+        tile->next->prev = tile->prev;
+    else
+        world->tail = tile->prev;
+    tile->prev = tile->next = NULL;
+}
+
+static void WorldPushFront(World *world, WorldTile *tile) {
+    tile->next = world->head;
+    if (world->head)
+        world->head->prev = tile;
+    else
+        world->tail = tile;
+    world->head = tile;
+}
+
+static WorldTile* WorldFind(World *world, int x, int y, int level, uint64_t key) {
+    for (WorldTile *tile = world->buckets[WorldBucket(x, y, level, key)]; tile; tile = tile->chain)
+        if (tile->x == x && tile->y == y && tile->level == level && tile->key == key)
+            return tile;
+    return NULL;
+}
+
+/* Sampling every k pixels is the same as shrinking the scale */
+static WorldTile* WorldInsert(World *world, int x, int y, int level, uint64_t key, const FBMParams *params) {
+    WorldTile *tile = calloc(1, sizeof(WorldTile));
+    float k = (float)(1 << level);
+    tile->x = x;
+    tile->y = y;
+    tile->level = level;
+    tile->key = key;
+    tile->params = *params;
+    tile->params.w = tile->params.h = WORLD_TILE;
+    tile->params.xoff = (float)x * WORLD_TILE;
+    tile->params.yoff = (float)y * WORLD_TILE;
+    tile->params.scale = params->scale / k;
+    tile->params.normalize = NORMALIZE_GLOBAL;
+    tile->params.derivatives = false;
+    tile->params.footprint = WORLD_FOOTPRINT;
+    unsigned int bucket = WorldBucket(x, y, level, key);
+    tile->chain = world->buckets[bucket];
+    world->buckets[bucket] = tile;
+    WorldPushFront(world, tile);
+    world->count++;
+    return tile;
+}
+
+static void WorldFree(World *world, WorldTile *tile) {
+    WorldTile **link = &world->buckets[WorldBucket(tile->x, tile->y, tile->level, tile->key)];
+    while (*link != tile)
+        link = &(*link)->chain;
+    *link = tile->chain;
+    WorldUnlink(world, tile);
+    DestroyTexture(tile->texture);
+    if (tile->cached.map)
+        DiskCacheUnmap(&tile->cached);
+    else
+        free(tile->heights);
+    free(tile);
+    world->count--;
+}
+
+/* Called with the lock held, wanted is already sorted nearest first */
+static WorldTile* WorldNextWanted(World *world) {
+    for (int i = 0; i < world->wantedCount; i++)
+        if (world->wanted[i]->status == WORLD_TILE_PENDING)
+            return world->wanted[i];
+    return NULL;
+}
+
+#if !WEB_BUILD
+/* Samples outside the map are left at 0 */
+static void WorldReadSource(const MappedHeightmap *source, const WorldTile *tile, float *heights) {
+    int step = 1 << tile->level;
+    int x0 = tile->x * WORLD_TILE * step, y0 = tile->y * WORLD_TILE * step;
+    int w = 0, h = 0, sx = 0, sy = 0;
+    /* First sample inside the map and how many follow, per axis */
+    while (sx < WORLD_TILE && x0 + sx * step < 0)
+        sx++;
+    while (sx + w < WORLD_TILE && x0 + (sx + w) * step < (int)source->header->w)
+        w++;
+    while (sy < WORLD_TILE && y0 + sy * step < 0)
+        sy++;
+    while (sy + h < WORLD_TILE && y0 + (sy + h) * step < (int)source->header->h)
+        h++;
+    memset(heights, 0, WORLD_TILE * WORLD_TILE * sizeof(float));
+    for (int y = 0; y < h; y++)
+        MappedHeightmapRead(source, heights + (sy + y) * WORLD_TILE + sx, x0 + sx * step, y0 + (sy + y) * step, w, 1, step);
+}
+#endif
+
+/* Called with the lock held, it's dropped while the noise is generated or
+   mapped back in from disk */
+static void WorldGenerate(World *world, WorldTile *tile) {
+    tile->status = WORLD_TILE_GENERATING;
+    FBMParams params = tile->params;
+    uint64_t key = WorldDiskKey(tile);
+    size_t size = WORLD_TILE * WORLD_TILE * sizeof(float);
+    CachedBlob cached = {0};
+    float *heights;
+#if !WEB_BUILD
+    /* SetWorldSource waits for busy to clear before unmapping */
+    if (world->source.header) {
+        MappedHeightmap source = world->source;
+        world->busy = true;
+        WorldUnlock(world);
+        heights = malloc(size);
+        WorldReadSource(&source, tile, heights);
+        WorldLock(world);
+        world->busy = false;
+        cnd_broadcast(&world->idle);
+        tile->heights = heights;
+        tile->status = WORLD_TILE_READY;
+        return;
+    }
+#endif
+    WorldUnlock(world);
+    if (DiskCacheMap(world->disk, key, size, &cached))
+        heights = (float*)cached.data;
+    else {
+        heights = malloc(size);
+        FBMGenerate(&world->fbm, &params, heights);
+        DiskCacheStore(world->disk, key, (const void*[]) { heights }, &size, 1);
+    }
+    WorldLock(world);
+    tile->heights = heights;
+    tile->cached = cached;
+    tile->status = WORLD_TILE_READY;
+}
+
+#if !WEB_BUILD
+static int WorldWorker(void *arg) {
+    World *world = (World*)arg;
+    mtx_lock(&world->lock);
+    for (;;) {
+        WorldTile *tile = NULL;
+        while (!world->quit && !(tile = WorldNextWanted(world)))
+            cnd_wait(&world->wake, &world->lock);
+        if (world->quit)
+            break;
+        WorldGenerate(world, tile);
+    }
+    mtx_unlock(&world->lock);
+    return 0;
+}
+#endif
+
+World* NewWorld(size_t budget, DiskCache *disk) {
+    World *world = calloc(1, sizeof(World));
+    world->budget = budget;
+    world->disk = disk;
+    world->buckets = calloc(WORLD_BUCKETS, sizeof(WorldTile*));
+    world->pixels = malloc((WORLD_TILE * WORLD_TILE + MipChainSize(WORLD_TILE, WORLD_TILE)) * sizeof(int));
+    world->fbm = NewFBM();
+#if !WEB_BUILD
+    mtx_init(&world->lock, mtx_plain);
+    cnd_init(&world->wake);
+    cnd_init(&world->idle);
+    thrd_create(&world->thread, WorldWorker, world);
+#endif
+    return world;
+}
+
+static int WorldComparePriority(const void *a, const void *b) {
+    float pa = (*(WorldTile* const*)a)->priority, pb = (*(WorldTile* const*)b)->priority;
+    return (pa > pb) - (pa < pb);
+}
+
+void UpdateWorld(World *world, const FBMParams *params, const int *palette, int level, int x0, int y0, int x1, int y1, int uploads) {
+    world->frame++;
+    if (memcmp(world->colors, palette, sizeof(world->colors))) {
+        memcpy(world->colors, palette, sizeof(world->colors));
+        world->palette++;
+    }
+    uint64_t key = WorldKey(params);
+#if !WEB_BUILD
+    if (world->source.header)
+        key = world->sourceKey;
+#endif
+    float span = (float)(WORLD_TILE << level);
+    int tx0 = (int)floorf(x0 / span), tx1 = (int)floorf((x1 - 1) / span);
+    int ty0 = (int)floorf(y0 / span), ty1 = (int)floorf((y1 - 1) / span);
+    int needed = (tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+    float cx = (x0 + x1) * .5f / span - .5f, cy = (y0 + y1) * .5f / span - .5f;
+
+    /* The worker walks wanted under the lock, so it can't move outside it */
+    WorldLock(world);
+    if (needed > world->capacity) {
+        world->capacity = needed;
+        world->visible = realloc(world->visible, needed * sizeof(WorldTile*));
+        world->fallbacks = realloc(world->fallbacks, needed * sizeof(WorldTile*));
+        world->wanted = realloc(world->wanted, needed * sizeof(WorldTile*));
+        world->uploads = realloc(world->uploads, needed * sizeof(WorldTile*));
+    }
+    world->visibleCount = world->fallbackCount = world->wantedCount = world->uploadCount = 0;
+    for (int ty = ty0; ty <= ty1; ty++)
+        for (int tx = tx0; tx <= tx1; tx++) {
+            WorldTile *tile = WorldFind(world, tx, ty, level, key);
+            if (!tile)
+                tile = WorldInsert(world, tx, ty, level, key, params);
+            else {
+                WorldUnlink(world, tile);
+                WorldPushFront(world, tile);
+            }
+            tile->frame = world->frame;
+            tile->priority = (tx - cx) * (tx - cx) + (ty - cy) * (ty - cy);
+            world->visible[world->visibleCount++] = tile;
+            if (tile->status == WORLD_TILE_PENDING)
+                world->wanted[world->wantedCount++] = tile;
+            else if (tile->status == WORLD_TILE_READY && (!tile->texture.id || tile->palette != world->palette))
+                world->uploads[world->uploadCount++] = tile;
+        }
+    /* Whatever coarser level is cached stands in for tiles still missing */
+    for (int i = 0; i < world->visibleCount; i++) {
+        WorldTile *tile = world->visible[i];
+        if (tile->texture.id)
+            continue;
+        for (int up = 1; level + up <= WORLD_MAX_LEVEL; up++) {
+            WorldTile *parent = WorldFind(world, tile->x >> up, tile->y >> up, level + up, key);
+            if (!parent || !parent->texture.id)
+                continue;
+            if (parent->frame != world->frame) {
+                parent->frame = world->frame;
+                WorldUnlink(world, parent);
+                WorldPushFront(world, parent);
+                world->fallbacks[world->fallbackCount++] = parent;
+            }
+            break;
+        }
+    }
+    qsort(world->wanted, world->wantedCount, sizeof(WorldTile*), WorldComparePriority);
+    qsort(world->uploads, world->uploadCount, sizeof(WorldTile*), WorldComparePriority);
+
+    /* Tiles on screen or still being generated are never evicted */
+    WorldTile *tile = world->tail;
+    while (tile && world->count * WORLD_TILE_BYTES > world->budget) {
+        WorldTile *prev = tile->prev;
+        if (tile->frame != world->frame && tile->status != WORLD_TILE_GENERATING)
+            WorldFree(world, tile);
+        tile = prev;
+    }
+#if !WEB_BUILD
+    if (world->wantedCount)
+        cnd_signal(&world->wake);
+#else
+    for (int i = 0; i < uploads && (tile = WorldNextWanted(world)); i++) {
+        WorldGenerate(world, tile);
+        world->uploads[world->uploadCount++] = tile;
+    }
+#endif
+    WorldUnlock(world);
+
+    /* Ready tiles are only ever freed from this thread, so these are safe.
+       Tiles are coloured here rather than on the pool, which the worker may
+       be holding for a whole batch */
+    Bitmap pixels = {
+        .buf = world->pixels,
+        .w = WORLD_TILE,
+        .h = WORLD_TILE
+    };
+    for (int i = 0; i < MIN(uploads, world->uploadCount); i++) {
+        WorldTile *upload = world->uploads[i];
+        ApplyPaletteLocal(world->colors, upload->heights, &pixels);
+        if (!upload->texture.id)
+            upload->texture = NewMipTexture(WORLD_TILE, WORLD_TILE);
+        UpdateMipTexture(upload->texture, world->pixels, WORLD_TILE, WORLD_TILE, world->pixels + WORLD_TILE * WORLD_TILE);
+        upload->palette = world->palette;
+    }
+}
+
+void DestroyWorld(World *world) {
+    if (!world)
+        return;
+#if !WEB_BUILD
+    mtx_lock(&world->lock);
+    world->quit = true;
+    cnd_signal(&world->wake);
+    mtx_unlock(&world->lock);
+    thrd_join(world->thread, NULL);
+    cnd_destroy(&world->wake);
+    cnd_destroy(&world->idle);
+    mtx_destroy(&world->lock);
+    if (world->source.header)
+        CloseMappedHeightmap(&world->source);
+#endif
+    while (world->head)
+        WorldFree(world, world->head);
+    DestroyFBM(&world->fbm);
+    free(world->buckets);
+    free(world->pixels);
+    free(world->visible);
+    free(world->fallbacks);
+    free(world->wanted);
+    free(world->uploads);
+    free(world);
+}
+
+#if !WEB_BUILD
+bool SetWorldSource(World *world, const char *path) {
+    MappedHeightmap source = {0};
+    if (path && !OpenMappedHeightmap(path, &source))
+        return false;
+    mtx_lock(&world->lock);
+    while (world->busy)
+        cnd_wait(&world->idle, &world->lock);
+    MappedHeightmap old = world->source;
+    world->source = source;
+    /* Keyed by the file's header so its tiles never mix with the noise's */
+    if (source.header)
+        world->sourceKey = CacheHash(CacheHash(CACHE_HASH_INIT, path, strlen(path)), source.header, sizeof(MappedHeightmapHeader));
+    mtx_unlock(&world->lock);
+    if (old.header)
+        CloseMappedHeightmap(&old);
+    return true;
+}
+#endif